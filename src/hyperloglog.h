@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+/// Number of hash bits selecting the register of a HyperLogLog sketch; the relative error is about 1.04 / 2^(p/2).
+constexpr int HYPERLOGLOG_PRECISION = 14;
+
+/// HyperLogLog sketch estimating the number of distinct items from their 64-bit hashes.
+/// It takes 2^HYPERLOGLOG_PRECISION bytes regardless of the number of items.
+struct HyperLogLog {
+    std::vector<uint8_t> registers = std::vector<uint8_t>(size_t(1) << HYPERLOGLOG_PRECISION, 0);
+
+    /// Add the item with the given hash.
+    inline void Add(uint64_t hash) {
+        size_t index = hash >> (64 - HYPERLOGLOG_PRECISION);
+        /* The position of the first set bit among the remaining ones; a sentinel bit bounds it. */
+        uint64_t rest = (hash << HYPERLOGLOG_PRECISION) | (uint64_t(1) << (HYPERLOGLOG_PRECISION - 1));
+        auto rank = (uint8_t) (__builtin_clzll(rest) + 1);
+        if (rank > registers[index]) registers[index] = rank;
+    }
+
+    /// Add all the items of the other sketch.
+    void Merge(const HyperLogLog &other) {
+        for (size_t i = 0; i < registers.size(); ++i) registers[i] = std::max(registers[i], other.registers[i]);
+    }
+
+    /// Estimate the number of distinct items added; small cardinalities are estimated by linear counting.
+    double Estimate() const {
+        double m = (double) registers.size();
+        double sum = 0;
+        size_t zeros = 0;
+        for (auto &&r : registers) {
+            sum += std::ldexp(1.0, -r);
+            zeros += r == 0;
+        }
+        double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+        if (estimate <= 2.5 * m && zeros) estimate = m * std::log(m / (double) zeros);
+        return estimate;
+    }
+};
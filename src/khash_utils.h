@@ -2,114 +2,508 @@
 
 #include <vector>
 #include <list>
+#include <algorithm>
+#include <type_traits>
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
 
 #include "kmers.h"
 #include "khash.h"
+#include "kthread.h"
+#include "swisstable.h"
 
 typedef unsigned char byte;
 
-#define kh_int128_hash_func(key) kh_int64_hash_func((khint64_t)((key)>>65^(key)^(key)<<21))
+/// The wide k-mers are hashed with MixKMer, which mixes every 64-bit limb of the k-mer into the whole hash.
+/// Folding the limbs with shifts and xors first keeps the structure of 2-bit encoded repeats and clusters the buckets.
+#define kh_int128_hash_func(key) ((khint_t)MixKMer((kmer128_t)(key)))
 #define kh_int128_hash_equal(a, b) ((a) == (b))
-#define kh_int256_hash_func(key) kh_int128_hash_func((__uint128_t)((key)>>129^(key)^(key)<<35))
 #define kh_int256_hash_equal(a, b) ((a) == (b))
 
+inline khint_t kh_int256_hash_func(const kmer256_t &key) {
+    return (khint_t)MixKMer(key);
+}
+
 #define KHASH_MAP_INIT_INT128(name, khval_t)								\
 	KHASH_INIT(name, __uint128_t, khval_t, 1, kh_int128_hash_func, kh_int128_hash_equal)
 
 #define KHASH_MAP_INIT_INT256(name, khval_t)								\
-	KHASH_INIT(name, uint256_t, khval_t, 1, kh_int256_hash_func, kh_int128_hash_equal)
+	KHASH_INIT(name, kmer256_t, khval_t, 1, kh_int256_hash_func, kh_int256_hash_equal)
+
+#define KHASH_SET_INIT_INT128(name)										\
+	KHASH_INIT(name, __uint128_t, char, 0, kh_int128_hash_func, kh_int128_hash_equal)
+
+#define KHASH_SET_INIT_INT256(name)										\
+	KHASH_INIT(name, kmer256_t, char, 0, kh_int256_hash_func, kh_int256_hash_equal)
 
 KHASH_MAP_INIT_INT256(S256M, byte)
+KHASH_SET_INIT_INT256(S256S)
 KHASH_MAP_INIT_INT128(S128M, byte)
+KHASH_SET_INIT_INT128(S128S)
 KHASH_MAP_INIT_INT64(S64M, byte)
 KHASH_SET_INIT_INT64(S64S)
 
-byte MINIMUM_ABUNDANCE = 1;
+/// Number of buckets of the smallest set processed by one thread at a time when intersecting.
+constexpr size_t INTERSECTION_CHUNK_SIZE = 1 << 16;
+/// Number of k-mers whose lookups are prefetched together when intersecting.
+constexpr size_t INTERSECTION_BATCH_SIZE = 16;
 
-// Forward definition for the macro.
+/// Prefetch the bucket of the khash table where the lookup of a k-mer with the given hash starts.
 template <typename KHT>
-void differenceInPlace(KHT* kMerSet, KHT* intersection, int k, bool complements);
+inline void khashPrefetchBucket(KHT *kMers, khint_t hash) {
+    if (!kMers->n_buckets) return;
+    khint_t i = hash & (kMers->n_buckets - 1);
+    __builtin_prefetch(&kMers->flags[i >> 4]);
+    __builtin_prefetch(&kMers->keys[i]);
+}
 
-#define INIT_KHASH_UTILS(type, variant)                                                                             \
-                                                                                                                    \
-/* Data for parallel computation of set differences. */                                                             \
-struct DifferenceInPlaceData##variant {                                                                             \
-    std::vector<kh_S##variant##_t*> kMerSets;                                                                       \
-    kh_S##variant##_t* intersection;                                                                                \
-    int k;                                                                                                          \
-    bool complements;                                                                                               \
-};                                                                                                                  \
-                                                                                                                    \
-/* Determine whether the canonical k-mer is present.*/                                                              \
-inline bool containsCanonicalKMer(kh_S##variant##_t *kMers, kmer##type##_t kMer) {                                  \
-    bool contains_key = kh_get_S##variant(kMers, kMer) != kh_end(kMers);                                            \
-    if (MINIMUM_ABUNDANCE == 1) return contains_key;                                                                \
-    if (!contains_key) return false;                                                                                \
-    return kh_val(kMers, kh_get_S##variant(kMers, kMer)) >= MINIMUM_ABUNDANCE;                                      \
-}                                                                                                                   \
-                                                                                                                    \
-/* Determine whether the canonical form of a k-mer is present.*/                                                    \
-inline bool containsKMer(kh_S##variant##_t *kMers, kmer##type##_t kMer, int k, bool complements) {                  \
-    if (complements) kMer = CanonicalKMer(kMer, k);                                                                 \
-    return containsCanonicalKMer(kMers, kMer);                                                                      \
-}                                                                                                                   \
-                                                                                                                    \
-/* Remove the canonical k-mer from the set.*/                                                                       \
-inline void eraseCanonicalKMer(kh_S##variant##_t *kMers, kmer##type##_t kMer) {                                     \
-    auto key = kh_get_S##variant(kMers, kMer);                                                                      \
-    if (key != kh_end(kMers)) {                                                                                     \
-        kh_del_S##variant(kMers, key);                                                                              \
+/// Find the index of the k-mer with the given precomputed hash in the khash table in a single probe sequence;
+/// kh_end if it is not present. This mirrors kh_get.
+template <typename KHT, typename kmer_t>
+inline khint_t khashGetWithHash(KHT *kMers, kmer_t kMer, khint_t hash) {
+    if (!kMers->n_buckets) return 0;
+    khint_t mask = kMers->n_buckets - 1, step = 0;
+    khint_t i = hash & mask, last = i;
+    while (!__ac_isempty(kMers->flags, i) && (__ac_isdel(kMers->flags, i) || !(kMers->keys[i] == kMer))) {
+        i = (i + (++step)) & mask;
+        if (i == last) return kMers->n_buckets;
+    }
+    return __ac_iseither(kMers->flags, i) ? kMers->n_buckets : i;
+}
+
+/// Insert the k-mer with the given precomputed hash into the khash table if it is not present, like kh_put,
+/// but only probe the buckets in [begin, end), whose flags are not shared with other buckets if the bounds are
+/// multiples of 16, and do not update the size, so that several threads can fill disjoint buckets at once.
+/// Return kh_end without any change if the probe sequence leaves the buckets or meets a deleted one.
+template <typename KHT, typename kmer_t>
+inline khint_t khashPutInRange(KHT *kMers, kmer_t kMer, khint_t hash, khint_t begin, khint_t end, int *ret) {
+    khint_t mask = kMers->n_buckets - 1, step = 0;
+    for (khint_t i = hash & mask; begin <= i && i < end && step < kMers->n_buckets; i = (i + (++step)) & mask) {
+        if (__ac_isempty(kMers->flags, i)) {
+            kMers->keys[i] = kMer;
+            __ac_set_isboth_false(kMers->flags, i);
+            *ret = 1;
+            return i;
+        }
+        if (__ac_isdel(kMers->flags, i)) break;
+        if (kMers->keys[i] == kMer) {
+            *ret = 0;
+            return i;
+        }
+    }
+    return kMers->n_buckets;
+}
+
+/// Count the buckets probed by kh_get to find the k-mer with the given hash at the given index of the khash table.
+template <typename KHT>
+inline khint_t khashProbeLength(KHT *kMers, khint_t hash, khint_t index) {
+    khint_t mask = kMers->n_buckets - 1, step = 0;
+    for (khint_t i = hash & mask; i != index; i = (i + step) & mask) ++step;
+    return step + 1;
+}
+
+/// Count the buckets probed by kh_get to find that a k-mer whose probe sequence starts at the given bucket is absent.
+template <typename KHT>
+inline khint_t khashMissProbeLength(KHT *kMers, khint_t start) {
+    khint_t mask = kMers->n_buckets - 1, step = 0;
+    for (khint_t i = start; !__ac_isempty(kMers->flags, i) && step < kMers->n_buckets; i = (i + step) & mask) ++step;
+    return step + 1;
+}
+
+/// Whether the k-mer tables log their rehashes; enabled for the diagnostics in the statistics file.
+inline bool recordRehashes = false;
+
+/// The rehashes of one k-mer table and the time spent in them.
+struct RehashRecord {
+    size_t count = 0;
+    double seconds = 0;
+};
+
+/// The rehashes logged for each k-mer table by its address.
+/// Rehashes are rare, so a single lock guards all the tables.
+struct RehashLog {
+    std::mutex lock;
+    std::unordered_map<const void*, RehashRecord> records;
+};
+
+inline RehashLog rehashLog;
+
+/// Run the operation on the table and log it as a rehash if it returns true.
+template <typename F>
+inline void logRehash(const void *table, F operation) {
+    auto start = std::chrono::steady_clock::now();
+    if (!operation()) return;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::lock_guard<std::mutex> lock(rehashLog.lock);
+    auto &record = rehashLog.records[table];
+    ++record.count;
+    record.seconds += seconds;
+}
+
+/// Return the rehashes logged for the table and forget them.
+inline RehashRecord takeRehashes(const void *table) {
+    std::lock_guard<std::mutex> lock(rehashLog.lock);
+    auto found = rehashLog.records.find(table);
+    if (found == rehashLog.records.end()) return RehashRecord();
+    RehashRecord record = found->second;
+    rehashLog.records.erase(found);
+    return record;
+}
+
+/// Return the rehashes logged for the table.
+inline RehashRecord rehashesOf(const void *table) {
+    std::lock_guard<std::mutex> lock(rehashLog.lock);
+    auto found = rehashLog.records.find(table);
+    return found == rehashLog.records.end() ? RehashRecord() : found->second;
+}
+
+/// Add the rehashes of a temporary table, e.g. a shard, to those of the table it is merged into.
+inline void mergeRehashes(const void *table, const void *merged) {
+    if (!recordRehashes) return;
+    RehashRecord record = takeRehashes(merged);
+    std::lock_guard<std::mutex> lock(rehashLog.lock);
+    rehashLog.records[table].count += record.count;
+    rehashLog.records[table].seconds += record.seconds;
+}
+
+/// Operations of the k-mer hash table KHT, whose khash functions are generated with a separate name for each variant.
+/// Both khash tables and KMerSwissTable provide the fields used by kh_begin, kh_end, kh_size, kh_key and kh_val;
+/// everything else goes through these operations.
+template <typename KHT>
+struct KMerTable;
+
+#define INIT_KMER_TABLE(type, variant)                                                                              \
+template <>                                                                                                         \
+struct KMerTable<kh_S##variant##_t> {                                                                               \
+    typedef kmer##type##_t kmer_t;                                                                                  \
+    static constexpr bool hasValues = std::is_same<decltype(kh_S##variant##_t::vals), byte*>::value;               \
+    static constexpr bool isKhash = true;                                                                           \
+    static inline double MaxLoad() { return __ac_HASH_UPPER; }                                                      \
+    static inline kh_S##variant##_t *Init() { return kh_init_S##variant(); }                                        \
+    static inline void Destroy(kh_S##variant##_t *kMers) {                                                          \
+        if (recordRehashes) takeRehashes(kMers);                                                                    \
+        kh_destroy_S##variant(kMers);                                                                               \
     }                                                                                                               \
-}                                                                                                                   \
-                                                                                                                    \
-/* Remove the canonical form of a k-mer from the set.*/                                                             \
-inline void eraseKMer(kh_S##variant##_t *kMers, kmer##type##_t kMer, int k, bool complements) {                     \
-    if (complements) kMer = CanonicalKMer(kMer, k);                                                                 \
-    eraseCanonicalKMer(kMers, kMer);                                                                                \
-}                                                                                                                   \
-                                                                                                                    \
-/* Insert the canonical k-mer into the set. */                                                                      \
-inline void insertCanonicalKMer(kh_S##variant##_t *kMers, kmer##type##_t kMer, bool force=false) {                  \
-    int ret;                                                                                                        \
-    if (MINIMUM_ABUNDANCE == (byte)1) {                                                                             \
-        kh_put_S##variant(kMers, kMer, &ret);                                                                       \
-    } else {                                                                                                        \
-        byte value = 0;                                                                                             \
-        khint_t key = kh_get_S##variant(kMers, kMer);                                                               \
-        if (key != kh_end(kMers)) {                                                                                 \
-            value = kh_val(kMers, key);                                                                             \
-        } else {                                                                                                    \
-            key = kh_put_S##variant(kMers, kMer, &ret);                                                             \
+    static inline void Clear(kh_S##variant##_t *kMers) { kh_clear_S##variant(kMers); }                              \
+    static inline khint_t Get(kh_S##variant##_t *kMers, kmer_t kMer) { return kh_get_S##variant(kMers, kMer); }     \
+    static inline khint_t Put(kh_S##variant##_t *kMers, kmer_t kMer, int *ret) {                                    \
+        if (__builtin_expect(recordRehashes && kMers->n_occupied >= kMers->upper_bound, 0)) {                       \
+            khint_t index;                                                                                          \
+            logRehash(kMers, [&] { index = kh_put_S##variant(kMers, kMer, ret); return true; });                    \
+            return index;                                                                                           \
         }                                                                                                           \
-        if (force || value == (byte)255) kh_value(kMers, key) = (byte)255;                                          \
-        else kh_value(kMers, key) = value + 1;                                                                      \
+        return kh_put_S##variant(kMers, kMer, ret);                                                                 \
+    }                                                                                                               \
+    static inline void Del(kh_S##variant##_t *kMers, khint_t index) { kh_del_S##variant(kMers, index); }            \
+    static inline void Resize(kh_S##variant##_t *kMers, khint_t buckets) {                                          \
+        if (recordRehashes) logRehash(kMers, [&] { return kh_resize_S##variant(kMers, buckets) == 0; });            \
+        else kh_resize_S##variant(kMers, buckets);                                                                  \
+    }                                                                                                               \
+    static inline size_t Tombstones(kh_S##variant##_t *kMers) { return kMers->n_occupied - kMers->size; }           \
+    static inline khint_t Hash(kmer_t kMer) { return (khint_t)kh_int##type##_hash_func(kMer); }                     \
+    static inline bool Exists(kh_S##variant##_t *kMers, khint_t index) { return kh_exist(kMers, index); }           \
+    static inline void Prefetch(kh_S##variant##_t *kMers, khint_t hash) { khashPrefetchBucket(kMers, hash); }        \
+    static inline khint_t GetWithHash(kh_S##variant##_t *kMers, kmer_t kMer, khint_t hash) {                        \
+        return khashGetWithHash(kMers, kMer, hash);                                                                 \
     }                                                                                                               \
-}                                                                                                                   \
-                                                                                                                    \
-/* Insert the canonical k-mer into the set. */                                                                      \
-inline void insertKMer(kh_S##variant##_t *kMers, kmer##type##_t kMer, int k, bool complements, bool force=false) {  \
-    if (complements) kMer = CanonicalKMer(kMer, k);                                                                 \
-    insertCanonicalKMer(kMers, kMer, force);                                                                        \
-}                                                                                                                   \
-                                                                                                                    \
-/* Parallel wrapper for differenceInPlace. */                                                                       \
-void DifferenceInPlaceThread##variant(void *arg, long i, int _) {                                                   \
-    auto data = (DifferenceInPlaceData##variant*)arg;                                                               \
-    differenceInPlace(data->kMerSets[i], data->intersection, data->k, data->complements);                           \
-}                                                                                                                   \
-
-INIT_KHASH_UTILS(64, 64S)
-INIT_KHASH_UTILS(64, 64M)
-INIT_KHASH_UTILS(128, 128M)
-INIT_KHASH_UTILS(256, 256M)
+    static inline khint_t PutInRange(kh_S##variant##_t *kMers, kmer_t kMer, khint_t hash, khint_t begin, khint_t end, \
+            int *ret) {                                                                                             \
+        return khashPutInRange(kMers, kMer, hash, begin, end, ret);                                                 \
+    }                                                                                                               \
+    static inline void AddInserted(kh_S##variant##_t *kMers, khint_t count) {                                       \
+        kMers->size += count;                                                                                       \
+        kMers->n_occupied += count;                                                                                 \
+    }                                                                                                               \
+    static inline khint_t ProbeLength(kh_S##variant##_t *kMers, khint_t index) {                                    \
+        return khashProbeLength(kMers, Hash(kh_key(kMers, index)), index);                                         \
+    }                                                                                                               \
+    static inline khint_t MissProbeLength(kh_S##variant##_t *kMers, khint_t start) {                                \
+        return khashMissProbeLength(kMers, start);                                                                  \
+    }                                                                                                               \
+};                                                                                                                  \
+
+INIT_KMER_TABLE(64, 64S)
+INIT_KMER_TABLE(64, 64M)
+INIT_KMER_TABLE(128, 128S)
+INIT_KMER_TABLE(128, 128M)
+INIT_KMER_TABLE(256, 256S)
+INIT_KMER_TABLE(256, 256M)
+
+template <typename kmer_type, bool HasValues>
+struct KMerTable<KMerSwissTable<kmer_type, HasValues>> {
+    typedef kmer_type kmer_t;
+    typedef KMerSwissTable<kmer_t, HasValues> table_t;
+    static constexpr bool hasValues = HasValues;
+    static constexpr bool isKhash = false;
+    static inline double MaxLoad() { return SWISS_MAX_LOAD; }
+    static inline table_t *Init() { return new table_t(); }
+    static inline void Destroy(table_t *kMers) {
+        if (recordRehashes) takeRehashes(kMers);
+        delete kMers;
+    }
+    static inline void Clear(table_t *kMers) { kMers->Clear(); }
+    static inline khint_t Get(table_t *kMers, kmer_t kMer) { return kMers->Get(kMer); }
+    static inline khint_t Put(table_t *kMers, kmer_t kMer, int *ret) {
+        if (__builtin_expect(recordRehashes && kMers->growthLeft == 0, 0)) {
+            khint_t index;
+            auto ctrl = kMers->ctrl;
+            logRehash(kMers, [&] { index = kMers->Put(kMer, ret); return kMers->ctrl != ctrl; });
+            return index;
+        }
+        return kMers->Put(kMer, ret);
+    }
+    static inline void Del(table_t *kMers, khint_t index) { kMers->Del(index); }
+    static inline void Resize(table_t *kMers, khint_t buckets) {
+        auto ctrl = kMers->ctrl;
+        if (recordRehashes) logRehash(kMers, [&] { kMers->Resize(buckets); return kMers->ctrl != ctrl; });
+        else kMers->Resize(buckets);
+    }
+    static inline size_t Tombstones(table_t *kMers) { return kMers->Tombstones(); }
+    static inline khint_t Hash(kmer_t kMer) { return table_t::Hash(kMer); }
+    static inline bool Exists(table_t *kMers, khint_t index) { return kMers->Exists(index); }
+    static inline void Prefetch(table_t *kMers, khint_t hash) { kMers->Prefetch(hash); }
+    static inline khint_t GetWithHash(table_t *kMers, kmer_t kMer, khint_t hash) { return kMers->Find(kMer, hash); }
+    static inline khint_t PutInRange(table_t *kMers, kmer_t kMer, khint_t hash, khint_t begin, khint_t end, int *ret) {
+        return kMers->PutInRange(kMer, hash, begin, end, ret);
+    }
+    static inline void AddInserted(table_t *kMers, khint_t count) { kMers->AddInserted(count); }
+    static inline khint_t ProbeLength(table_t *kMers, khint_t index) { return kMers->ProbeLength(index); }
+    static inline khint_t MissProbeLength(table_t *kMers, khint_t start) { return kMers->MissProbeLength(start); }
+};
+
+/// The tables of k-mer sets (Set) and of k-mers with abundances (Map) used for the computation.
+/// They are khash tables, or Swiss tables if the program is built with SWISS_TABLES=1.
+#ifdef PROPHASM_SWISS_TABLES
+typedef KMerSwissTable<kmer64_t, false> KMerSet64;
+typedef KMerSwissTable<kmer64_t, true> KMerMap64;
+typedef KMerSwissTable<kmer128_t, false> KMerSet128;
+typedef KMerSwissTable<kmer128_t, true> KMerMap128;
+typedef KMerSwissTable<kmer256_t, false> KMerSet256;
+typedef KMerSwissTable<kmer256_t, true> KMerMap256;
+#else
+typedef kh_S64S_t KMerSet64;
+typedef kh_S64M_t KMerMap64;
+typedef kh_S128S_t KMerSet128;
+typedef kh_S128M_t KMerMap128;
+typedef kh_S256S_t KMerSet256;
+typedef kh_S256M_t KMerMap256;
+#endif
+
+/// The k-mer type stored in the hash table KHT.
+template <typename KHT>
+using KMerOf = typename KMerTable<KHT>::kmer_t;
+
+/// Determine whether the hash table stores abundance values; sets store no values.
+/// Tables with values count the occurrences of each k-mer, sets only record its presence.
+template <typename KHT>
+using TableHasValues = std::integral_constant<bool, KMerTable<KHT>::hasValues>;
+
+/// Determine whether there is a k-mer at the given index.
+template <typename KHT>
+inline bool isKMerAt(KHT *kMers, khint_t index) {
+    return KMerTable<KHT>::Exists(kMers, index);
+}
+
+/// Find the index of the canonical k-mer; kh_end if it is not present.
+template <typename KHT>
+inline khint_t findCanonicalKMer(KHT *kMers, KMerOf<KHT> kMer) {
+    return KMerTable<KHT>::Get(kMers, kMer);
+}
+
+/// Determine whether the canonical k-mer is present.
+template <typename KHT>
+inline bool containsCanonicalKMer(KHT *kMers, KMerOf<KHT> kMer) {
+    return findCanonicalKMer(kMers, kMer) != kh_end(kMers);
+}
+
+/// Compute the hash of the canonical k-mer as used by the set.
+template <typename KHT>
+inline khint_t hashCanonicalKMer(KHT *kMers, KMerOf<KHT> kMer) {
+    return KMerTable<KHT>::Hash(kMer);
+}
+
+/// Prefetch the bucket where the lookup of a k-mer with the given hash starts.
+template <typename KHT>
+inline void prefetchBucket(KHT *kMers, khint_t hash) {
+    KMerTable<KHT>::Prefetch(kMers, hash);
+}
+
+/// Prefetch the bucket where the lookup of the canonical k-mer starts.
+template <typename KHT>
+inline void prefetchCanonicalKMer(KHT *kMers, KMerOf<KHT> kMer) {
+    prefetchBucket(kMers, hashCanonicalKMer(kMers, kMer));
+}
+
+/// Find the index of the canonical k-mer with the given precomputed hash in a single probe sequence;
+/// kh_end if it is not present.
+template <typename KHT>
+inline khint_t findCanonicalKMerWithHash(KHT *kMers, KMerOf<KHT> kMer, khint_t hash) {
+    return KMerTable<KHT>::GetWithHash(kMers, kMer, hash);
+}
+
+/// Determine whether the canonical form of a k-mer is present.
+template <typename KHT>
+inline bool containsKMer(KHT *kMers, KMerOf<KHT> kMer, int k, bool complements) {
+    if (complements) kMer = CanonicalKMer(kMer, k);
+    return containsCanonicalKMer(kMers, kMer);
+}
+
+/// Remove the canonical k-mer from the set.
+template <typename KHT>
+inline void eraseCanonicalKMer(KHT *kMers, KMerOf<KHT> kMer) {
+    auto key = KMerTable<KHT>::Get(kMers, kMer);
+    if (key != kh_end(kMers)) {
+        KMerTable<KHT>::Del(kMers, key);
+    }
+}
+
+/// Remove the k-mer at the given index from the set.
+template <typename KHT>
+inline void eraseKMerAt(KHT *kMers, khint_t index) {
+    KMerTable<KHT>::Del(kMers, index);
+}
+
+/// Remove the canonical form of a k-mer from the set.
+template <typename KHT>
+inline void eraseKMer(KHT *kMers, KMerOf<KHT> kMer, int k, bool complements) {
+    if (complements) kMer = CanonicalKMer(kMer, k);
+    eraseCanonicalKMer(kMers, kMer);
+}
+
+/// Insert the canonical k-mer into the set with the given abundance, adding it to the existing one.
+/// Sets only record that the k-mer is present.
+template <typename KHT>
+inline void insertCanonicalKMerWithAbundance(KHT *kMers, KMerOf<KHT> kMer, byte abundance) {
+    int ret;
+    khint_t key = KMerTable<KHT>::Put(kMers, kMer, &ret);
+    if constexpr (TableHasValues<KHT>::value) {
+        int value = ret == 0 ? kh_val(kMers, key) : 0;
+        kh_value(kMers, key) = (byte)std::min(255, value + abundance);
+    }
+}
+
+/// Insert the canonical k-mer into the set, counting its occurrences if the set stores abundances.
+template <typename KHT>
+inline void insertCanonicalKMer(KHT *kMers, KMerOf<KHT> kMer) {
+    insertCanonicalKMerWithAbundance(kMers, kMer, 1);
+}
+
+/// Insert the canonical form of a k-mer into the set.
+template <typename KHT>
+inline void insertKMer(KHT *kMers, KMerOf<KHT> kMer, int k, bool complements) {
+    if (complements) kMer = CanonicalKMer(kMer, k);
+    insertCanonicalKMer(kMers, kMer);
+}
+
+/// Get the abundance of the k-mer stored at the given index; 1 if abundances are not tracked.
+template <typename KHT>
+inline byte abundanceAt(KHT *kMers, khint_t index) {
+    if constexpr (TableHasValues<KHT>::value) return kh_val(kMers, index);
+    else return 1;
+}
+
+/// Resize the set so that it can hold the given number of k-mers without rehashing.
+template <typename KHT>
+inline void reserveKMers(KHT *kMers, size_t count) {
+    auto buckets = (khint_t)(count / KMerTable<KHT>::MaxLoad()) + 1;
+    if (buckets > kh_end(kMers)) KMerTable<KHT>::Resize(kMers, buckets);
+}
+
+/// Remove the k-mers which do not appear at least minimumAbundance times from the set.
+/// The set is then rehashed to the size of the remaining k-mers, so that the removed ones do not slow down the lookups.
+/// This compiles to nothing for sets, which do not store abundances.
+template <typename KHT>
+inline void removeRareKMers(KHT *kMers, byte minimumAbundance) {
+    if constexpr (TableHasValues<KHT>::value) {
+        if (minimumAbundance <= 1) return;
+        size_t removed = 0;
+        for (auto i = kh_begin(kMers); i != kh_end(kMers); ++i) {
+            if (isKMerAt(kMers, i) && kh_val(kMers, i) < minimumAbundance) {
+                KMerTable<KHT>::Del(kMers, i);
+                ++removed;
+            }
+        }
+        if (removed) KMerTable<KHT>::Resize(kMers, (khint_t)(kh_size(kMers) / KMerTable<KHT>::MaxLoad()) + 1);
+    }
+}
+
+/// Number of bins of the probe length histograms; bin i > 0 counts the lengths in (2^(i-1), 2^i], the last one the rest.
+constexpr size_t PROBE_HISTOGRAM_BINS = 8;
+/// Maximum number of start positions sampled to measure the probe lengths of absent k-mers.
+constexpr size_t MISS_PROBE_SAMPLES = 1 << 20;
+
+/// Lengths of the probe sequences of lookups in a hash table.
+/// They are counted in buckets for khash tables and in groups of slots for Swiss tables; 1 is the best possible.
+struct ProbeLengthStats {
+    size_t lookups = 0;
+    size_t total = 0;
+    size_t max = 0;
+    std::array<size_t, PROBE_HISTOGRAM_BINS> histogram = {};
+
+    void Add(size_t length) {
+        ++lookups;
+        total += length;
+        max = std::max(max, length);
+        size_t bin = length <= 1 ? 0 : 64 - __builtin_clzll(length - 1);
+        ++histogram[std::min(bin, PROBE_HISTOGRAM_BINS - 1)];
+    }
+
+    double Mean() const {
+        return lookups ? (double)total / lookups : 0;
+    }
+};
+
+/// Measure the probe sequence lengths of all the k-mers in the set, which shows how well the hash spreads them.
+template <typename KHT>
+ProbeLengthStats probeLengthStats(KHT *kMers) {
+    ProbeLengthStats stats;
+    for (auto i = kh_begin(kMers); i != kh_end(kMers); ++i) {
+        if (isKMerAt(kMers, i)) stats.Add(KMerTable<KHT>::ProbeLength(kMers, i));
+    }
+    return stats;
+}
+
+/// Measure the probe sequence lengths of lookups of absent k-mers, which also pass through the deleted buckets.
+/// The lookups start at evenly spaced buckets, as those of k-mers with uniformly distributed hashes would.
+template <typename KHT>
+ProbeLengthStats missProbeLengthStats(KHT *kMers) {
+    ProbeLengthStats stats;
+    size_t stride = std::max((size_t)1, (size_t)kh_end(kMers) / MISS_PROBE_SAMPLES);
+    for (size_t start = 0; start < kh_end(kMers); start += stride) {
+        stats.Add(KMerTable<KHT>::MissProbeLength(kMers, start));
+    }
+    return stats;
+}
+
+/// Summary of the state of a k-mer table for the diagnostics in the statistics file.
+struct TableDiagnostics {
+    size_t capacity;
+    size_t kMers;
+    size_t tombstones;
+    RehashRecord rehashes;
+    ProbeLengthStats hits;
+    ProbeLengthStats misses;
+
+    double Load() const {
+        return capacity ? (double)kMers / capacity : 0;
+    }
+};
+
+/// Collect the diagnostics of the k-mer table; this scans the whole table.
+template <typename KHT>
+TableDiagnostics tableDiagnostics(KHT *kMers) {
+    return {kh_end(kMers), kh_size(kMers), KMerTable<KHT>::Tombstones(kMers), rehashesOf(kMers),
+            probeLengthStats(kMers), missProbeLengthStats(kMers)};
+}
 
 /// Return the next k-mer in the k-mer set and update the index.
 template <typename KHT, typename kmer_t>
-inline kmer_t nextKMer(KHT *kMers, size_t &lastIndex, kmer_t &kMer) {
+inline bool nextKMer(KHT *kMers, size_t &lastIndex, kmer_t &kMer) {
     for (size_t i = kh_begin(kMers) + lastIndex; i != kh_end(kMers); ++i, ++lastIndex) {
-        if (!kh_exist(kMers, i)) continue;
+        if (!isKMerAt(kMers, i)) continue;
         kMer = kh_key(kMers, i);
-        if (MINIMUM_ABUNDANCE > 1) if (!containsKMer(kMers, kMer, 0, false)) continue;
         return true;
     }
     // No more k-mers.
@@ -118,12 +512,12 @@ inline kmer_t nextKMer(KHT *kMers, size_t &lastIndex, kmer_t &kMer) {
 }
 
 /// Construct a vector of the k-mer set in an arbitrary order. Only for testing.
-std::vector<kmer64_t> kMersToVec(kh_S64M_t *kMers) {
-    std::vector<kmer64_t> result(kh_size(kMers));
+template <typename KHT>
+std::vector<KMerOf<KHT>> kMersToVec(KHT *kMers) {
+    std::vector<KMerOf<KHT>> result(kh_size(kMers));
     size_t index = 0;
     for (auto i = kh_begin(kMers); i != kh_end(kMers); ++i) {
-        if (!kh_exist(kMers, i)) continue;
-        if (MINIMUM_ABUNDANCE > 1) if (!containsKMer(kMers, kh_key(kMers, i), 0, false)) continue;
+        if (!isKMerAt(kMers, i)) continue;
         result[index++] = kh_key(kMers, i);
     }
     result.resize(index);
@@ -131,39 +525,172 @@ std::vector<kmer64_t> kMersToVec(kh_S64M_t *kMers) {
 }
 
 /// Compute the intersection of several k-mer sets.
+/// The buckets of the smallest set are split among the threads, and each thread looks up its k-mers
+/// in the other sets in batches, prefetching the buckets of the whole batch first.
 template <typename KHT>
-KHT *getIntersection(KHT* result, std::vector<KHT*> &kMerSets) {
+KHT *getIntersection(KHT* result, std::vector<KHT*> &kMerSets, int threads = 1) {
+    typedef KMerOf<KHT> kmer_t;
     if (kMerSets.size() < 2) return result;
     KHT* smallestSet = kMerSets[0];
     for (size_t i = 1; i < kMerSets.size(); ++i) {
         if (kh_size(kMerSets[i]) < kh_size(smallestSet)) smallestSet = kMerSets[i];
     }
-    for (auto i = kh_begin(smallestSet); i != kh_end(smallestSet); ++i) {
-        if (!kh_exist(smallestSet, i)) continue;
-        auto kMer = kh_key(smallestSet, i);
-        if (!containsCanonicalKMer(smallestSet, kMer)) continue;
-        bool everywhere = true;
-        for (size_t i = 0; i < kMerSets.size(); ++i) if (kMerSets[i] != smallestSet) {
-            if (!containsCanonicalKMer(kMerSets[i], kMer)) {
-                everywhere = false;
-                break;
+    std::vector<KHT*> otherSets;
+    for (auto &&kMerSet : kMerSets) if (kMerSet != smallestSet) otherSets.push_back(kMerSet);
+    std::vector<std::vector<kmer_t>> partialResults(threads);
+    long chunkCount = (kh_end(smallestSet) + INTERSECTION_CHUNK_SIZE - 1) / INTERSECTION_CHUNK_SIZE;
+    ParallelFor(threads, chunkCount, [&](long chunk, int threadID) {
+        auto end = std::min(kh_end(smallestSet), (khint_t)((chunk + 1) * INTERSECTION_CHUNK_SIZE));
+        kmer_t batch[INTERSECTION_BATCH_SIZE];
+        for (auto i = (khint_t)(chunk * INTERSECTION_CHUNK_SIZE); i < end; ) {
+            size_t batchSize = 0;
+            for (; i < end && batchSize < INTERSECTION_BATCH_SIZE; ++i) {
+                if (!isKMerAt(smallestSet, i)) continue;
+                batch[batchSize++] = kh_key(smallestSet, i);
             }
+            /* Keep only the k-mers of the batch present in each of the sets. */
+            for (size_t j = 0; j < otherSets.size() && batchSize; ++j) {
+                for (size_t b = 0; b < batchSize; ++b) prefetchCanonicalKMer(otherSets[j], batch[b]);
+                size_t kept = 0;
+                for (size_t b = 0; b < batchSize; ++b) {
+                    if (containsCanonicalKMer(otherSets[j], batch[b])) batch[kept++] = batch[b];
+                }
+                batchSize = kept;
+            }
+            partialResults[threadID].insert(partialResults[threadID].end(), batch, batch + batchSize);
         }
-        if (everywhere) {
-            insertCanonicalKMer(result, kMer, true);
-        }
+    });
+    size_t resultSize = kh_size(result);
+    for (auto &&partialResult : partialResults) resultSize += partialResult.size();
+    reserveKMers(result, resultSize);
+    for (auto &&partialResult : partialResults) {
+        for (auto &&kMer : partialResult) insertCanonicalKMer(result, kMer);
+        std::vector<kmer_t>().swap(partialResult);
     }
     return result;
 }
 
-/// Subtract the intersection from each k-mer set.
+/// Subtract the intersection from the k-mer set.
+/// The k-mers of the intersection are canonical already, so they are erased as they are,
+/// in batches whose buckets are prefetched first.
 template <typename KHT>
-void differenceInPlace(KHT* kMerSet, KHT* intersection, int k, bool complements) {
-    for (auto i = kh_begin(intersection); i != kh_end(intersection); ++i) {
-        if (!kh_exist(intersection, i)) continue;
-        auto kMer = kh_key(intersection, i);
-        eraseKMer(kMerSet, kMer, k, complements);
+void differenceInPlace(KHT* kMerSet, KHT* intersection) {
+    KMerOf<KHT> batch[INTERSECTION_BATCH_SIZE];
+    khint_t hashes[INTERSECTION_BATCH_SIZE];
+    for (auto i = kh_begin(intersection); i != kh_end(intersection); ) {
+        size_t batchSize = 0;
+        for (; i != kh_end(intersection) && batchSize < INTERSECTION_BATCH_SIZE; ++i) {
+            if (!isKMerAt(intersection, i)) continue;
+            batch[batchSize] = kh_key(intersection, i);
+            hashes[batchSize] = hashCanonicalKMer(kMerSet, batch[batchSize]);
+            prefetchBucket(kMerSet, hashes[batchSize]);
+            ++batchSize;
+        }
+        for (size_t b = 0; b < batchSize; ++b) {
+            khint_t found = findCanonicalKMerWithHash(kMerSet, batch[b], hashes[b]);
+            if (found != kh_end(kMerSet)) eraseKMerAt(kMerSet, found);
+        }
     }
 }
 
+/// Operations over several k-mer sets, each of which decides about a k-mer from the sets which contain it.
+enum SetOperation {
+    /// The k-mers of any of the sets.
+    UNION_OPERATION,
+    /// The k-mers of the first set which are in none of the others.
+    DIFFERENCE_OPERATION,
+    /// The k-mers of an odd number of the sets, as the symmetric difference of the sets one after another.
+    SYMMETRIC_DIFFERENCE_OPERATION,
+    /// The k-mers of at least a given number of the sets.
+    QUORUM_OPERATION,
+};
 
+/// Compute the result of the set operation over the k-mer sets; quorum is the number of sets for QUORUM_OPERATION.
+/// Each k-mer is decided when the first set containing it is scanned, so that it is counted only once:
+/// the buckets of the sets are split among the threads in chunks, and each thread looks up the k-mers
+/// of a chunk in the earlier sets to skip those seen already, and then counts them in the later sets,
+/// in batches whose buckets are prefetched first. The sets from which no k-mer can get to the result are not scanned.
+template <typename KHT>
+KHT *getSetOperation(KHT *result, std::vector<KHT*> &kMerSets, SetOperation operation, size_t quorum = 0,
+        int threads = 1) {
+    typedef KMerOf<KHT> kmer_t;
+    size_t setCount = kMerSets.size();
+    if (operation == QUORUM_OPERATION && quorum <= 1) operation = UNION_OPERATION;
+    size_t scannedCount = setCount;
+    if (operation == DIFFERENCE_OPERATION) scannedCount = std::min(setCount, (size_t)1);
+    if (operation == QUORUM_OPERATION) scannedCount = quorum <= setCount ? setCount - quorum + 1 : 0;
+    std::vector<std::pair<size_t, khint_t>> chunks;
+    for (size_t j = 0; j < scannedCount; ++j) {
+        for (khint_t start = 0; start < kh_end(kMerSets[j]); start += INTERSECTION_CHUNK_SIZE) chunks.emplace_back(j, start);
+    }
+    std::vector<std::vector<kmer_t>> partialResults(threads);
+    ParallelFor(threads, chunks.size(), [&](long chunk, int threadID) {
+        size_t j = chunks[chunk].first;
+        KHT *scannedSet = kMerSets[j];
+        auto end = std::min(kh_end(scannedSet), (khint_t)(chunks[chunk].second + INTERSECTION_CHUNK_SIZE));
+        auto &partialResult = partialResults[threadID];
+        kmer_t batch[INTERSECTION_BATCH_SIZE];
+        size_t counts[INTERSECTION_BATCH_SIZE];
+        for (auto i = chunks[chunk].second; i < end; ) {
+            size_t batchSize = 0;
+            for (; i < end && batchSize < INTERSECTION_BATCH_SIZE; ++i) {
+                if (!isKMerAt(scannedSet, i)) continue;
+                batch[batchSize++] = kh_key(scannedSet, i);
+            }
+            /* Skip the k-mers decided in an earlier set. */
+            for (size_t l = 0; l < j && batchSize; ++l) {
+                for (size_t b = 0; b < batchSize; ++b) prefetchCanonicalKMer(kMerSets[l], batch[b]);
+                size_t kept = 0;
+                for (size_t b = 0; b < batchSize; ++b) {
+                    if (!containsCanonicalKMer(kMerSets[l], batch[b])) batch[kept++] = batch[b];
+                }
+                batchSize = kept;
+            }
+            std::fill(counts, counts + batchSize, 1);
+            /* Count the k-mers in the later sets while they are undecided. */
+            for (size_t l = j + 1; l < setCount && batchSize && operation != UNION_OPERATION; ++l) {
+                for (size_t b = 0; b < batchSize; ++b) prefetchCanonicalKMer(kMerSets[l], batch[b]);
+                size_t kept = 0;
+                for (size_t b = 0; b < batchSize; ++b) {
+                    size_t count = counts[b] + containsCanonicalKMer(kMerSets[l], batch[b]);
+                    if (operation == DIFFERENCE_OPERATION && count > 1) continue;
+                    if (operation == QUORUM_OPERATION && count >= quorum) {
+                        partialResult.push_back(batch[b]);
+                        continue;
+                    }
+                    if (operation == QUORUM_OPERATION && count + (setCount - l - 1) < quorum) continue;
+                    batch[kept] = batch[b];
+                    counts[kept++] = count;
+                }
+                batchSize = kept;
+            }
+            for (size_t b = 0; b < batchSize; ++b) {
+                if (operation == SYMMETRIC_DIFFERENCE_OPERATION && counts[b] % 2 == 0) continue;
+                if (operation == QUORUM_OPERATION && counts[b] < quorum) continue;
+                partialResult.push_back(batch[b]);
+            }
+        }
+    });
+    size_t resultSize = kh_size(result);
+    for (auto &&partialResult : partialResults) resultSize += partialResult.size();
+    reserveKMers(result, resultSize);
+    for (auto &&partialResult : partialResults) {
+        for (auto &&kMer : partialResult) insertCanonicalKMer(result, kMer);
+        std::vector<kmer_t>().swap(partialResult);
+    }
+    return result;
+}
+
+/// Data for parallel computation of set differences.
+template <typename KHT>
+struct DifferenceInPlaceData {
+    std::vector<KHT*> kMerSets;
+    KHT* intersection;
+};
+
+/// Parallel wrapper for differenceInPlace.
+template <typename KHT>
+void DifferenceInPlaceThread(void *arg, long i, int _) {
+    auto data = (DifferenceInPlaceData<KHT>*)arg;
+    differenceInPlace(data->kMerSets[i], data->intersection);
+}
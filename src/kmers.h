@@ -3,12 +3,75 @@
 #include <string>
 #include <iostream>
 #include <cstdint>
+#include <type_traits>
 
-#include "uint256_t/uint256_t.h"
+/// Unsigned 256-bit word holding k-mers for k in 65..128.
+/// Only the operations used on k-mers are provided, and all of them are inlined.
+/// The lower half is stored first, so that the layout matches the former uint256_t keys of the snapshots.
+struct KMerWord256 {
+    __uint128_t lower, upper;
+
+    KMerWord256() = default;
+    constexpr KMerWord256(__uint128_t upper, __uint128_t lower) : lower(lower), upper(upper) {}
+    constexpr KMerWord256(__uint128_t value) : lower(value), upper(0) {}
+    template <typename T, typename = typename std::enable_if<std::is_integral<T>::value>::type>
+    constexpr KMerWord256(T value)
+        : lower((__uint128_t)value), upper((__int128)value < 0 ? ~(__uint128_t)0 : 0) {}
+
+    template <typename T, typename = typename std::enable_if<std::is_integral<T>::value>::type>
+    explicit constexpr operator T() const { return (T)lower; }
+    explicit constexpr operator __uint128_t() const { return lower; }
+
+    friend inline KMerWord256 operator<<(const KMerWord256 &w, int shift) {
+        if (shift == 0) return w;
+        if (shift >= 256) return KMerWord256(0, 0);
+        if (shift >= 128) return KMerWord256(w.lower << (shift - 128), 0);
+        return KMerWord256((w.upper << shift) | (w.lower >> (128 - shift)), w.lower << shift);
+    }
+    friend inline KMerWord256 operator>>(const KMerWord256 &w, int shift) {
+        if (shift == 0) return w;
+        if (shift >= 256) return KMerWord256(0, 0);
+        if (shift >= 128) return KMerWord256(0, w.upper >> (shift - 128));
+        return KMerWord256(w.upper >> shift, (w.lower >> shift) | (w.upper << (128 - shift)));
+    }
+    friend inline KMerWord256 operator&(const KMerWord256 &a, const KMerWord256 &b) {
+        return KMerWord256(a.upper & b.upper, a.lower & b.lower);
+    }
+    friend inline KMerWord256 operator|(const KMerWord256 &a, const KMerWord256 &b) {
+        return KMerWord256(a.upper | b.upper, a.lower | b.lower);
+    }
+    friend inline KMerWord256 operator^(const KMerWord256 &a, const KMerWord256 &b) {
+        return KMerWord256(a.upper ^ b.upper, a.lower ^ b.lower);
+    }
+    friend inline KMerWord256 operator~(const KMerWord256 &w) { return KMerWord256(~w.upper, ~w.lower); }
+    friend inline KMerWord256 operator+(const KMerWord256 &a, const KMerWord256 &b) {
+        __uint128_t lower = a.lower + b.lower;
+        return KMerWord256(a.upper + b.upper + (lower < a.lower), lower);
+    }
+    friend inline KMerWord256 operator-(const KMerWord256 &a, const KMerWord256 &b) {
+        return KMerWord256(a.upper - b.upper - (a.lower < b.lower), a.lower - b.lower);
+    }
+    friend inline bool operator==(const KMerWord256 &a, const KMerWord256 &b) {
+        return ((a.upper ^ b.upper) | (a.lower ^ b.lower)) == 0;
+    }
+    friend inline bool operator!=(const KMerWord256 &a, const KMerWord256 &b) { return !(a == b); }
+    friend inline bool operator<(const KMerWord256 &a, const KMerWord256 &b) {
+        return a.upper < b.upper || (a.upper == b.upper && a.lower < b.lower);
+    }
+    friend inline bool operator>(const KMerWord256 &a, const KMerWord256 &b) { return b < a; }
+    friend inline bool operator<=(const KMerWord256 &a, const KMerWord256 &b) { return !(b < a); }
+    friend inline bool operator>=(const KMerWord256 &a, const KMerWord256 &b) { return !(a < b); }
+
+    inline KMerWord256 &operator<<=(int shift) { return *this = *this << shift; }
+    inline KMerWord256 &operator>>=(int shift) { return *this = *this >> shift; }
+    inline KMerWord256 &operator&=(const KMerWord256 &w) { return *this = *this & w; }
+    inline KMerWord256 &operator|=(const KMerWord256 &w) { return *this = *this | w; }
+    inline KMerWord256 &operator^=(const KMerWord256 &w) { return *this = *this ^ w; }
+};
 
 typedef uint64_t kmer64_t;
 typedef __uint128_t kmer128_t;
-typedef uint256_t kmer256_t;
+typedef KMerWord256 kmer256_t;
 
 /// Convert the given basic nucleotide to int so it can be used for indexing in AC.
 /// If non-existing nucleotide is given, return -1.
@@ -29,13 +92,13 @@ inline int NucleotideToInt (char c) {
 /// Compute the prefix of size d of the given k-mer.
 template <typename kmer_t>
 inline kmer_t BitPrefix(kmer_t kMer, int k, int d) {
-    return kMer >> ((k - d) << kmer_t(1));
+    return kMer >> ((k - d) << 1);
 }
 
 /// Compute the suffix of size d of the given k-mer.
 template <typename kmer_t>
 inline kmer_t BitSuffix(kmer_t kMer, int d) {
-    return kMer & ((kmer_t(1) << (d << kmer_t(1))) - kmer_t(1));
+    return kMer & ((kmer_t(1) << (d << 1)) - kmer_t(1));
 }
 
 /// Checkered mask. cmask<uint16_t, 1> is every other bit on
@@ -52,34 +115,22 @@ struct cmask<U, len, 0> {
 };
 
 /// Compute the reverse complement of a word.
-/// Copyright: Jellyfish GPL-3.0
+/// The bytes are reversed by a single byte swap, so that only the nucleotides within each byte need to be swapped.
 inline kmer64_t word_reverse_complement(kmer64_t w) {
     typedef kmer64_t U;
-    w = ((w >> 2)  & cmask<U, 2 >::v) | ((w & cmask<U, 2 >::v) << 2);
-    w = ((w >> 4)  & cmask<U, 4 >::v) | ((w & cmask<U, 4 >::v) << 4);
-    w = ((w >> 8)  & cmask<U, 8 >::v) | ((w & cmask<U, 8 >::v) << 8);
-    w = ((w >> 16) & cmask<U, 16>::v) | ((w & cmask<U, 16>::v) << 16);
-    w = ( w >> 32                   ) | ( w                    << 32);
-    return ((U)-1) - w;
+    w = __builtin_bswap64(w);
+    w = ((w >> 4) & cmask<U, 4>::v) | ((w & cmask<U, 4>::v) << 4);
+    w = ((w >> 2) & cmask<U, 2>::v) | ((w & cmask<U, 2>::v) << 2);
+    return ~w;
 }
 /// Compute the reverse complement of a word.
-/// Copyright: Jellyfish GPL-3.0
+/// The halves are reversed separately in 64-bit registers and swapped.
 inline kmer128_t word_reverse_complement(kmer128_t w) {
-    typedef kmer128_t U;
-    w = ((w >> 2)  & cmask<U, 2 >::v) | ((w & cmask<U, 2 >::v) << 2);
-    w = ((w >> 4)  & cmask<U, 4 >::v) | ((w & cmask<U, 4 >::v) << 4);
-    w = ((w >> 8)  & cmask<U, 8 >::v) | ((w & cmask<U, 8 >::v) << 8);
-    w = ((w >> 16) & cmask<U, 16>::v) | ((w & cmask<U, 16>::v) << 16);
-    w = ((w >> 32) & cmask<U, 32>::v) | ((w & cmask<U, 32>::v) << 32);
-    w = ( w >> 64                   ) | ( w                    << 64);
-    return ((U)-1) - w;
+    return ((kmer128_t) word_reverse_complement((kmer64_t) w) << 64) | word_reverse_complement((kmer64_t) (w >> 64));
 }
 /// Compute the reverse complement of a word.
-/// Copyright: Jellyfish GPL-3.0
 inline kmer256_t word_reverse_complement(kmer256_t w) {
-    kmer128_t low = word_reverse_complement(w.lower());
-    kmer128_t high = word_reverse_complement(w.upper());
-    return kmer256_t(low, high);
+    return kmer256_t(word_reverse_complement(w.lower), word_reverse_complement(w.upper));
 }
 
 constexpr int KMER_SIZE_64 = 64;
@@ -95,7 +146,7 @@ inline kmer##type##_t MaskForK##type(int k) {
                                                                                                                                       \
 /* Compute the reverse complement of the given k-mer. */                                                                              \
 inline kmer##type##_t ReverseComplement(kmer##type##_t kMer, int k) {                                                                 \
-    return (((kmer##type##_t)word_reverse_complement(kMer)) >> (KMER_SIZE_##type - (k << kmer##type##_t(1)))) & MaskForK##type(k);    \
+    return (((kmer##type##_t)word_reverse_complement(kMer)) >> (KMER_SIZE_##type - (k << 1))) & MaskForK##type(k);    \
 }                                                                                                                                     \
 
 INIT_KMERS(64)
@@ -109,12 +160,38 @@ inline kmer_t CanonicalKMer(kmer_t kMer, int k) {
     return kMer < rev ? kMer : rev;
 }
 
+/// The k-mer size known at compile time. It converts to int, so it can be passed wherever k is expected,
+/// and the masks and shifts derived from it become immediates once the callee is inlined.
+template <int K>
+struct ConstantK {
+    constexpr operator int() const { return K; }
+};
+
+/// Determine whether the code for k-mers of size k stored in kmer_t is specialized at compile time.
+/// Only the commonly used sizes are specialized, each in the narrowest word it fits into.
+template <typename kmer_t>
+constexpr bool IsSpecializedK(int k) {
+    constexpr int maxK = sizeof(kmer_t) * 4;
+    return k <= maxK && (maxK == 32 || k > maxK / 2);
+}
+
+/// Call f with k as a ConstantK if it is one of the specialized sizes, and with k as an int otherwise.
+template <typename kmer_t, typename F>
+inline auto WithK(int k, F &&f) {
+    if constexpr (IsSpecializedK<kmer_t>(15)) if (k == 15) return f(ConstantK<15>());
+    if constexpr (IsSpecializedK<kmer_t>(21)) if (k == 21) return f(ConstantK<21>());
+    if constexpr (IsSpecializedK<kmer_t>(25)) if (k == 25) return f(ConstantK<25>());
+    if constexpr (IsSpecializedK<kmer_t>(31)) if (k == 31) return f(ConstantK<31>());
+    if constexpr (IsSpecializedK<kmer_t>(63)) if (k == 63) return f(ConstantK<63>());
+    return f(k);
+}
+
 const char letters[4] {'A', 'C', 'G', 'T'};
 
 /// Return the index-th nucleotide from the encoded k-mer.
 template <typename kmer_t>
 inline char NucleotideAtIndex(kmer_t encoded, int k, int index) {
-    return letters[(uint32_t)(encoded >> ((k - index - kmer_t(1)) << kmer_t(1))) & kmer_t(3)];
+    return letters[(uint32_t)((encoded >> ((k - index - 1) << 1)) & kmer_t(3))];
 }
 
 /// Convert the encoded KMer representation to string.
@@ -129,3 +206,23 @@ std::string NumberToKMer(kmer_t encoded, int length) {
     }
     return ret;
 }
+
+/// Mix the bits of the given number (splitmix64 finalizer).
+inline uint64_t MixBits(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/// Compute a 64-bit hash of the k-mer with all bits mixed.
+inline uint64_t MixKMer(kmer64_t kMer) {
+    return MixBits(kMer);
+}
+inline uint64_t MixKMer(kmer128_t kMer) {
+    return MixBits((kmer64_t) kMer ^ MixBits((kmer64_t) (kMer >> 64)));
+}
+inline uint64_t MixKMer(kmer256_t kMer) {
+    return MixBits(MixKMer(kMer.lower) ^ MixBits(MixKMer(kMer.upper)));
+}
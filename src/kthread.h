@@ -9,6 +9,15 @@ void kt_for(int n_threads, void (*func)(void*,long,int), void *data, long n);
 
 #ifdef __cplusplus
 }
+
+#include <type_traits>
+
+/// Run func(i, threadID) for i in [0, n) on the given number of threads using kt_for.
+template <typename F>
+void ParallelFor(int threads, long n, F &&func) {
+    typedef typename std::remove_reference<F>::type FT;
+    kt_for(threads, [](void *arg, long i, int threadID) { (*(FT *) arg)(i, threadID); }, (void *) &func, n);
+}
 #endif
 
 #endif
@@ -1,12 +1,21 @@
 #include <iostream>
 #include <string>
+#include <cmath>
+#include <memory>
+#include <atomic>
+#include <functional>
 
 #include "unistd.h"
+#include "getopt.h"
 #include "version.h"
 #include "prophasm.h"
 #include "parser.h"
+#include "partition.h"
+#include "writer.h"
 #include "kthread.h"
 #include "khash_utils.h"
+#include "scheduler.h"
+#include "membership.h"
 
 
 constexpr int MAX_K = 128;
@@ -20,6 +29,7 @@ int Help() {
               "Contact:  Ondrej Sladky <ondra.sladky@gmail.com>\n" <<
               "\n" <<
               "Usage:    prophasm2 [options]\n" <<
+              "          prophasm2 index [options]\n" <<
               "\n" <<
               "Examples: prophasm2 -k 15 -i f1.fa -i f2.fa -x fx.fa -t 2\n" <<
               "             - compute intersection of f1 and f2 on two threads\n" <<
@@ -29,17 +39,44 @@ int Help() {
               "             - re-assemble f1 to g1\n" <<
               "          prophasm2 -k 15 -i f1.fa -o g1.fa -m 2\n" <<
               "             - assemble k-mers appearing at least twice in f1 to g1\n" <<
+              "          prophasm2 -k 15 -i f1.fa -i f2.fa -i f3.fa -a 2 -o g.fa\n" <<
+              "             - assemble k-mers appearing in at least two of f1, f2 and f3 to g\n" <<
+              "          prophasm2 index -k 15 -i f1.fa -o f1.ph2\n" <<
+              "             - save the k-mer set of f1 with abundances to a snapshot, which can be used with -i\n" <<
               "\n" <<
               "Command-line parameters:\n" <<
               " -k INT   K-mer size.\n" <<
-              " -i FILE  Input FASTA file (can be used multiple times).\n" <<
-              " -o FILE  Output FASTA file (if used, must be used as many times as -i).\n" <<
-              " -x FILE  Compute intersection, subtract it, save it.\n" <<
+              " -i FILE  Input FASTA file, possibly gzipped, or a snapshot (can be used multiple times).\n" <<
+              " -o FILE  Output FASTA file, gzipped if it ends with .gz, or snapshot with index\n" <<
+              "          (if used, must be used as many times as -i).\n" <<
+              " -x FILE  Compute intersection, subtract it, save it (gzipped if it ends with .gz).\n" <<
+              " -a OP    Compute a set operation over all the inputs and assemble it to the only -o file:\n" <<
+              "          union, difference (the first input minus the others), symdiff (k-mers\n" <<
+              "          in an odd number of inputs), or INT (k-mers in at least INT inputs).\n" <<
+              " -c       Keep the k-mers of all the inputs in a single table with the inputs containing\n" <<
+              "          each k-mer (only with -x). Each input is loaded to a table of its own, which is\n" <<
+              "          added to the single table and freed; the inputs are added one at a time. The peak\n" <<
+              "          memory is the single table and a full table of each input being loaded.\n" <<
+              " -C FILE  Group the k-mers by the exact subset of the inputs containing them (color class)\n" <<
+              "          and assemble each class to FILE, with records named CLASS_SIMPLITIG. The inputs\n" <<
+              "          of each class are listed in FILE.colors.\n" <<
               " -s FILE  Output file with k-mer statistics.\n" <<
+              " -D       Add hash table diagnostics to the statistics file: capacity, load factor,\n" <<
+              "          tombstones, rehashes and probe lengths of each table after each stage.\n" <<
               " -t INT   Number of threads (default 1).\n" <<
               " -m INT   Minimum abundance of k-mers to appear in the assembly (default 1).\n" <<
+              " -w INT   Wrap the output sequences at INT characters (default no wrapping).\n" <<
               " -S       Silent mode.\n" <<
               " -u       Do not consider k-mer and its reverse complement as equivalent.\n" <<
+              " -L       Low-memory intersection: load only the smallest input and stream the others\n" <<
+              "          (only with -x and without -o).\n" <<
+              " -e       Estimate the number of distinct k-mers of each input in an extra pass\n" <<
+              "          and size its table in advance, which avoids rehashing while loading.\n" <<
+              " -M SIZE  Memory budget, e.g. 64G (also --max-memory). Without -x, a set is only loaded\n" <<
+              "          once the assembled sets have freed enough memory. If the k-mer sets are estimated\n" <<
+              "          not to fit, they are partitioned on disk and processed one partition at a time.\n" <<
+              " --tmp-dir DIR\n" <<
+              "          Directory for the temporary files of the partitioned mode (default $TMPDIR or /tmp).\n" <<
               "\n" <<
               "Note that '-' can be used for standard input/output. \n" <<
               std::endl;
@@ -50,6 +87,38 @@ void Version() {
     std::cerr << VERSION << std::endl;
 }
 
+/// Parse the memory size with an optional K, M, G or T suffix. Return 0 if it is not valid.
+size_t ParseMemorySize(const std::string &size) {
+    char *end;
+    double value = strtod(size.c_str(), &end);
+    std::string suffix(end);
+    if (value <= 0 || suffix.size() > 1) return 0;
+    size_t multiplier = 1;
+    if (suffix.empty()) multiplier = 1;
+    else if (toupper(suffix[0]) == 'K') multiplier = size_t(1) << 10;
+    else if (toupper(suffix[0]) == 'M') multiplier = size_t(1) << 20;
+    else if (toupper(suffix[0]) == 'G') multiplier = size_t(1) << 30;
+    else if (toupper(suffix[0]) == 'T') multiplier = size_t(1) << 40;
+    else return 0;
+    return size_t(value * multiplier);
+}
+
+/// Parse the set operation: union, difference, symdiff, or the number of sets for the quorum.
+/// Return false if it is not valid.
+bool ParseSetOperation(const std::string &name, SetOperation &operation, size_t &quorum) {
+    if (name == "union") operation = UNION_OPERATION;
+    else if (name == "difference") operation = DIFFERENCE_OPERATION;
+    else if (name == "symdiff") operation = SYMMETRIC_DIFFERENCE_OPERATION;
+    else {
+        char *end;
+        long value = strtol(name.c_str(), &end, 10);
+        if (name.empty() || *end != '\0' || value < 1) return false;
+        operation = QUORUM_OPERATION;
+        quorum = (size_t)value;
+    }
+    return true;
+}
+
 void TestFile(FILE *fo, std::string fn) {
     if (fo == nullptr) {
         std::cerr << "Error: file '" << fn << "' could not be open (error " << errno << ", " << strerror(errno) << ")." << std::endl;
@@ -57,149 +126,675 @@ void TestFile(FILE *fo, std::string fn) {
     }
 }
 
-#define INIT_RUN(type, version)                                                                                         \
-                                                                                                                        \
-int run##version(int32_t k,                                                                                             \
-    std::string intersectionPath,                                                                                       \
-    std::vector<std::string> inPaths,                                                                                   \
-    std::vector<std::string> outPaths,                                                                                  \
-    std::string statsPath,                                                                                              \
-    FILE *fstats,                                                                                                       \
-    bool computeIntersection,                                                                                           \
-    bool computeOutput,                                                                                                 \
-    bool verbose,                                                                                                       \
-    bool complements,                                                                                                   \
-    int threads,                                                                                                        \
-    size_t setCount) {                                                                                                  \
-                                                                                                                        \
-    if (verbose) {                                                                                                      \
-        std::cerr << "=====================" << std::endl;                                                              \
-        std::cerr << "1) Loading references" << std::endl;                                                              \
-        std::cerr << "=====================" << std::endl;                                                              \
-    }                                                                                                                   \
-    std::vector<kh_S##version##_t*> fullSets(setCount);                                                                 \
-    std::vector<size_t> inSizes = std::vector<size_t>(setCount);                                                        \
-    std::vector<size_t> outSizes;                                                                                       \
-                                                                                                                        \
-    for (size_t i = 0; i < setCount; i++) {                                                                             \
-        fullSets[i] = kh_init_S##version();                                                                             \
-    }                                                                                                                   \
-                                                                                                                        \
-    ReadKMersData##version data = {fullSets, inPaths, k, complements};                                                  \
-    kt_for(threads, ReadKMersThread##version, (void*)&data, setCount);                                                  \
-                                                                                                                        \
-    for (size_t i = 0; i < setCount; i++) {                                                                             \
-        if (verbose) {                                                                                                  \
-            std::cerr << "Loaded " << inPaths[i] << std::endl;                                                          \
-        }                                                                                                               \
-        inSizes[i] = kh_size(fullSets[i]);                                                                              \
-        if (fstats != nullptr) {                                                                                        \
-            fprintf(fstats,"%s\t%lu\n", inPaths[i].c_str(), inSizes[i]);                                                \
-        }                                                                                                               \
-    }                                                                                                                   \
-                                                                                                                        \
-    if (verbose) {                                                                                                      \
-        std::cerr << "===============" << std::endl;                                                                    \
-        std::cerr << "2) Intersecting" << std::endl;                                                                    \
-        std::cerr << "===============" << std::endl;                                                                    \
-    }                                                                                                                   \
-    kh_S##version##_t* intersection = kh_init_S##version();                                                             \
-    size_t intersectionSize = 0;                                                                                        \
-    if (computeIntersection) {                                                                                          \
-        if (verbose) {                                                                                                  \
-            std::cerr << "2.1) Computing intersection" << std::endl;                                                    \
-        }                                                                                                               \
-        getIntersection(intersection, fullSets);                                                                        \
-        intersectionSize  = kh_size(intersection);                                                                      \
-        if (verbose) {                                                                                                  \
-            std::cerr << "   intersection size: " <<  intersectionSize << std::endl;                                    \
-        }                                                                                                               \
-        if (computeOutput) {                                                                                            \
-            if (verbose) {                                                                                              \
-                std::cerr << "2.2) Removing this intersection from all k-mer sets" << std::endl;                        \
-            }                                                                                                           \
-            DifferenceInPlaceData##version data = {fullSets, intersection, k, complements};                             \
-            kt_for(threads, DifferenceInPlaceThread##version, (void*)&data, setCount);                                  \
-        }                                                                                                               \
-    }                                                                                                                   \
-    if (computeOutput) {                                                                                                \
-        for (size_t i = 0; i < setCount; i++) {                                                                         \
-            outSizes.push_back(kh_size(fullSets[i]));                                                                   \
-            if (inSizes[i] != outSizes[i] + intersectionSize) {                                                         \
-                std::cerr << "Internal error: k-mer set sizes do not correspond "                                       \
-                    << inSizes[i] << " != " << outSizes[i] << " + " << intersectionSize << std::endl;                   \
-                return 1;                                                                                               \
-            }                                                                                                           \
-            if (verbose){                                                                                               \
-                std::cerr << inSizes[i] << " " << outSizes[i] << " ...inter:" << intersectionSize << std::endl;         \
-            }                                                                                                           \
-        }                                                                                                               \
-    }                                                                                                                   \
-                                                                                                                        \
-    if (verbose){                                                                                                       \
-        std::cerr << "=============" << std::endl;                                                                      \
-        std::cerr << "3) Assembling" << std::endl;                                                                      \
-        std::cerr << "=============" << std::endl;                                                                      \
-    }                                                                                                                   \
-    if (computeOutput) {                                                                                                \
-        std::vector<std::ostream*> ofs (setCount);                                                                      \
-        std::vector<std::ofstream> filestreams (setCount);                                                              \
-                                                                                                                        \
-        for (size_t i = 0; i < setCount; i++) {                                                                         \
-            if (outPaths[i] != "-") {                                                                                   \
-                filestreams[i] = std::ofstream(outPaths[i]);                                                            \
-                ofs[i] = &filestreams[i];                                                                               \
-            } else {                                                                                                    \
-                ofs[i] = &std::cout;                                                                                    \
-            }                                                                                                           \
-            if (fstats) {                                                                                               \
-                fprintf(fstats,"%s\t%lu\n", outPaths[i].c_str(), outSizes[i]);                                          \
-            }                                                                                                           \
-        }                                                                                                               \
-        ComputeSimplitigsData##version data = {fullSets, ofs, k, complements, std::vector<int>(setCount)};              \
-        kt_for(threads, ComputeSimplitigsThread##version, (void*)&data, setCount);                                      \
-                                                                                                                        \
-        for (size_t i = 0; i < setCount; i++) {                                                                         \
-            if (verbose) {                                                                                              \
-                std::cerr << "   assembly finished (" << data.simplitigsCounts[i] << " contigs)" << std::endl;          \
-            }                                                                                                           \
-            if (filestreams[i].is_open()) {                                                                             \
-                filestreams[i].close();                                                                                 \
-            }                                                                                                           \
-        }                                                                                                               \
-    }                                                                                                                   \
-    if (computeIntersection) {                                                                                          \
-        std::ostream *of;                                                                                               \
-        std::ofstream filestream;                                                                                       \
-        if (intersectionPath != "-") {                                                                                  \
-            filestream = std::ofstream(intersectionPath);                                                               \
-            of = &filestream;                                                                                           \
-        }                                                                                                               \
-        else {                                                                                                          \
-            of = &std::cout;                                                                                            \
-        }                                                                                                               \
-        if (fstats) {                                                                                                   \
-            fprintf(fstats,"%s\t%lu\n", intersectionPath.c_str(), intersectionSize);                                    \
-        }                                                                                                               \
-        int simplitigCount = ComputeSimplitigs(intersection, *of, k, complements);                                      \
-        if (verbose) {                                                                                                  \
-            std::cerr << "   assembly finished (" << simplitigCount << " contigs)" << std::endl;                        \
-        }                                                                                                               \
-        if (filestream.is_open()) {                                                                                     \
-            filestream.close();                                                                                         \
-        }                                                                                                               \
-    }                                                                                                                   \
-    if (fstats){                                                                                                        \
-        fclose(fstats);                                                                                                 \
-    }                                                                                                                   \
-    return 0;                                                                                                           \
-}                                                                                                                       \
-
-
-INIT_RUN(64, 64S)
-INIT_RUN(64, 64M)
-INIT_RUN(128, 128M)
-INIT_RUN(256, 256M)
+/// Format the mean, maximum and histogram of the probe lengths as a field of the statistics file.
+std::string FormatProbeLengths(const char *name, const ProbeLengthStats &stats) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "\t%s=mean:%.3f,max:%zu", name, stats.Mean(), stats.max);
+    std::string field = buffer;
+    for (size_t bin = 0; bin < PROBE_HISTOGRAM_BINS; ++bin) {
+        size_t low = bin <= 1 ? bin + 1 : (size_t(1) << (bin - 1)) + 1, high = size_t(1) << bin;
+        if (bin + 1 == PROBE_HISTOGRAM_BINS) snprintf(buffer, sizeof(buffer), ",%zu+", low);
+        else if (low == high) snprintf(buffer, sizeof(buffer), ",%zu", low);
+        else snprintf(buffer, sizeof(buffer), ",%zu-%zu", low, high);
+        field += buffer + (":" + std::to_string(stats.histogram[bin]));
+    }
+    return field;
+}
+
+/// Format the diagnostics of the k-mer table of the given file after the given stage as a comment line
+/// of the statistics file, so that the lines with the k-mer counts keep their format.
+template <typename KHT>
+std::string FormatTableDiagnostics(const std::string &path, const char *stage, KHT *kMers) {
+    TableDiagnostics diagnostics = tableDiagnostics(kMers);
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "\tcapacity=%zu\tkmers=%zu\tload=%.3f\ttombstones=%zu\trehashes=%zu\trehash_seconds=%.3f",
+            diagnostics.capacity, diagnostics.kMers, diagnostics.Load(), diagnostics.tombstones,
+            diagnostics.rehashes.count, diagnostics.rehashes.seconds);
+    return "# table\t" + path + "\t" + stage + buffer + FormatProbeLengths("hit_probes", diagnostics.hits)
+            + FormatProbeLengths("miss_probes", diagnostics.misses) + "\n";
+}
+
+/// Steps of the processing of a k-mer set; the later steps of a set run before the earlier steps of other sets.
+enum SetStep {
+    LOAD_STEP,
+    SUBTRACT_STEP,
+    ASSEMBLE_STEP,
+};
+
+
+template <typename KHT>
+int run(int32_t k,
+    std::string intersectionPath,
+    std::vector<std::string> inPaths,
+    std::vector<std::string> outPaths,
+    std::string statsPath,
+    FILE *fstats,
+    bool computeIntersection,
+    bool computeOutput,
+    bool verbose,
+    bool complements,
+    byte minimumAbundance,
+    int threads,
+    size_t setCount,
+    bool lowMemory,
+    bool presize,
+    bool diagnostics,
+    size_t maxMemory,
+    int lineWidth) {
+
+    /* Each set is loaded, subtracted and assembled by a chain of tasks on the pool, largest sets first.
+     * Only the intersection needs all the sets loaded; without it, each set is assembled as soon as it is loaded,
+     * and with a memory budget, a set is only loaded once enough of the assembled sets have been freed. */
+    bool pipelined = computeOutput && !computeIntersection;
+    std::mutex logLock;
+    auto log = [&](const std::string &message) {
+        if (!verbose) return;
+        std::lock_guard<std::mutex> lock(logLock);
+        std::cerr << message << std::endl;
+    };
+    if (verbose) {
+        std::string title = pipelined ? "1) Loading and assembling references" : "1) Loading references";
+        std::cerr << std::string(title.size(), '=') << std::endl;
+        std::cerr << title << std::endl;
+        std::cerr << std::string(title.size(), '=') << std::endl;
+    }
+    /* In the low-memory mode, only the smallest set is loaded and the others are streamed when intersecting. */
+    size_t loadedCount = lowMemory ? 0 : setCount;
+    std::vector<KHT*> fullSets(loadedCount);
+    std::vector<size_t> inSizes = std::vector<size_t>(setCount);
+    std::vector<size_t> outSizes = std::vector<size_t>(setCount);
+    std::vector<size_t> fileSizes(setCount);
+    std::vector<size_t> setMemory(setCount);
+    std::vector<int> simplitigCounts(setCount);
+    /* The statistics are written in the order of the inputs, whenever the tasks finish. */
+    std::vector<std::string> loadedDiagnostics(setCount), subtractedDiagnostics(setCount), assembledDiagnostics(setCount);
+    TaskPool pool(threads, pipelined ? maxMemory : 0);
+
+    /* The set is freed as soon as its simplitigs are written. */
+    auto assemble = [&](size_t i) {
+        FastaWriter writer(outPaths[i], lineWidth);
+        simplitigCounts[i] = ComputeSimplitigs(fullSets[i], writer, k, complements, pool.ThreadsPerTask());
+        if (diagnostics) assembledDiagnostics[i] = FormatTableDiagnostics(inPaths[i], "assembled", fullSets[i]);
+        writer.Close();
+        KMerTable<KHT>::Destroy(fullSets[i]);
+        fullSets[i] = nullptr;
+        pool.Release(setMemory[i]);
+        log("   assembly of " + outPaths[i] + " finished (" + std::to_string(simplitigCounts[i]) + " contigs)");
+    };
+    for (size_t i = 0; i < loadedCount; i++) {
+        fileSizes[i] = FileSize(inPaths[i]);
+        if (pipelined && maxMemory) setMemory[i] = (size_t) TableMemory({inPaths[i]}, k, minimumAbundance);
+        pool.Submit({LOAD_STEP, fileSizes[i]}, [&, i] {
+            fullSets[i] = KMerTable<KHT>::Init();
+            ReadKMers(fullSets[i], inPaths[i], k, complements, pool.ThreadsPerTask(), presize);
+            removeRareKMers(fullSets[i], minimumAbundance);
+            inSizes[i] = kh_size(fullSets[i]);
+            if (diagnostics) loadedDiagnostics[i] = FormatTableDiagnostics(inPaths[i], "loaded", fullSets[i]);
+            log("Loaded " + inPaths[i]);
+            if (pipelined) {
+                outSizes[i] = inSizes[i];
+                pool.Submit({ASSEMBLE_STEP, fileSizes[i]}, [&, i] { assemble(i); });
+            }
+        }, setMemory[i]);
+    }
+    pool.Wait();
+
+    for (size_t i = 0; i < loadedCount; i++) {
+        if (fstats != nullptr) {
+            fprintf(fstats,"%s\t%lu\n", inPaths[i].c_str(), inSizes[i]);
+            fputs(loadedDiagnostics[i].c_str(), fstats);
+        }
+    }
+    KHT* intersection = KMerTable<KHT>::Init();
+    size_t smallest = 0;
+    if (lowMemory) {
+        smallest = SmallestFile(inPaths);
+        ReadKMers(intersection, inPaths[smallest], k, complements, threads, presize);
+        removeRareKMers(intersection, minimumAbundance);
+        if (verbose) {
+            std::cerr << "Loaded " << inPaths[smallest] << std::endl;
+        }
+        if (fstats != nullptr) {
+            fprintf(fstats,"%s\t%lu\n", inPaths[smallest].c_str(), kh_size(intersection));
+            if (diagnostics) fputs(FormatTableDiagnostics(inPaths[smallest], "loaded", intersection).c_str(), fstats);
+        }
+    }
+
+    size_t intersectionSize = 0;
+    if (computeIntersection) {
+        if (verbose) {
+            std::cerr << "===============" << std::endl;
+            std::cerr << "2) Intersecting" << std::endl;
+            std::cerr << "===============" << std::endl;
+            std::cerr << "2.1) Computing intersection" << std::endl;
+        }
+        if (lowMemory) {
+            for (size_t i = 0; i < setCount; i++) if (i != smallest) {
+                IntersectWithFasta(intersection, inPaths[i], k, complements, minimumAbundance, threads);
+                if (verbose) {
+                    std::cerr << "   streamed " << inPaths[i] << ", " << kh_size(intersection) << " k-mers left"
+                        << std::endl;
+                }
+            }
+        } else {
+            getIntersection(intersection, fullSets, threads);
+        }
+        intersectionSize  = kh_size(intersection);
+        if (verbose) {
+            std::cerr << "   intersection size: " <<  intersectionSize << std::endl;
+        }
+        if (fstats && diagnostics) {
+            fputs(FormatTableDiagnostics(intersectionPath, "intersected", intersection).c_str(), fstats);
+        }
+    }
+
+    if (verbose && !pipelined) {
+        std::string title = computeOutput ? "3) Subtracting and assembling" : "3) Assembling";
+        std::cerr << std::string(title.size(), '=') << std::endl;
+        std::cerr << title << std::endl;
+        std::cerr << std::string(title.size(), '=') << std::endl;
+    }
+    std::atomic<bool> failed(false);
+    auto assembleIntersection = [&] {
+        FastaWriter writer(intersectionPath, lineWidth);
+        int simplitigCount = ComputeSimplitigs(intersection, writer, k, complements, pool.ThreadsPerTask());
+        writer.Close();
+        log("   assembly of " + intersectionPath + " finished (" + std::to_string(simplitigCount) + " contigs)");
+    };
+    if (computeIntersection && computeOutput) {
+        /* The intersection is assembled, which empties it, once it has been subtracted from all the sets. */
+        std::atomic<size_t> subtractionsLeft(setCount);
+        for (size_t i = 0; i < setCount; i++) {
+            pool.Submit({SUBTRACT_STEP, fileSizes[i]}, [&, i] {
+                differenceInPlace(fullSets[i], intersection);
+                outSizes[i] = kh_size(fullSets[i]);
+                if (diagnostics) subtractedDiagnostics[i] = FormatTableDiagnostics(inPaths[i], "subtracted", fullSets[i]);
+                if (--subtractionsLeft == 0) pool.Submit({ASSEMBLE_STEP, intersectionSize}, assembleIntersection);
+                if (inSizes[i] != outSizes[i] + intersectionSize) {
+                    std::lock_guard<std::mutex> lock(logLock);
+                    std::cerr << "Internal error: k-mer set sizes do not correspond "
+                        << inSizes[i] << " != " << outSizes[i] << " + " << intersectionSize << std::endl;
+                    failed = true;
+                    return;
+                }
+                log(std::to_string(inSizes[i]) + " " + std::to_string(outSizes[i]) + " ...inter:"
+                    + std::to_string(intersectionSize));
+                pool.Submit({ASSEMBLE_STEP, fileSizes[i]}, [&, i] { assemble(i); });
+            });
+        }
+    } else if (computeIntersection) {
+        pool.Submit({ASSEMBLE_STEP, intersectionSize}, assembleIntersection);
+    }
+    pool.Wait();
+    if (failed) {
+        for (auto &&kMers : fullSets) if (kMers) KMerTable<KHT>::Destroy(kMers);
+        KMerTable<KHT>::Destroy(intersection);
+        return 1;
+    }
+
+    if (fstats) {
+        if (computeOutput) {
+            for (size_t i = 0; i < setCount; i++) fputs(subtractedDiagnostics[i].c_str(), fstats);
+            for (size_t i = 0; i < setCount; i++) fprintf(fstats,"%s\t%lu\n", outPaths[i].c_str(), outSizes[i]);
+            for (size_t i = 0; i < setCount; i++) fputs(assembledDiagnostics[i].c_str(), fstats);
+        }
+        if (computeIntersection) {
+            fprintf(fstats,"%s\t%lu\n", intersectionPath.c_str(), intersectionSize);
+            /* All the k-mers are deleted by then, so this shows the tombstones left by the assembly. */
+            if (diagnostics) fputs(FormatTableDiagnostics(intersectionPath, "assembled", intersection).c_str(), fstats);
+        }
+        fclose(fstats);
+    }
+    /* Without -o, the sets were only needed for the intersection. */
+    for (auto &&kMers : fullSets) if (kMers) KMerTable<KHT>::Destroy(kMers);
+    KMerTable<KHT>::Destroy(intersection);
+    return 0;
+}
+
+/// Compute the set operation over all the inputs and assemble its result into a single output.
+/// The inputs are freed before the assembly, since the result no longer needs them.
+template <typename KHT>
+int runSetOperation(int32_t k,
+    std::vector<std::string> inPaths,
+    std::string outPath,
+    FILE *fstats,
+    bool verbose,
+    bool complements,
+    byte minimumAbundance,
+    int threads,
+    size_t setCount,
+    bool presize,
+    bool diagnostics,
+    SetOperation operation,
+    size_t quorum,
+    int lineWidth) {
+
+    std::mutex logLock;
+    if (verbose) {
+        std::cerr << "=====================" << std::endl;
+        std::cerr << "1) Loading references" << std::endl;
+        std::cerr << "=====================" << std::endl;
+    }
+    std::vector<KHT*> fullSets(setCount);
+    std::vector<std::string> loadedDiagnostics(setCount);
+    {
+        TaskPool pool(threads);
+        for (size_t i = 0; i < setCount; i++) {
+            pool.Submit({LOAD_STEP, FileSize(inPaths[i])}, [&, i] {
+                fullSets[i] = KMerTable<KHT>::Init();
+                ReadKMers(fullSets[i], inPaths[i], k, complements, pool.ThreadsPerTask(), presize);
+                removeRareKMers(fullSets[i], minimumAbundance);
+                if (diagnostics) loadedDiagnostics[i] = FormatTableDiagnostics(inPaths[i], "loaded", fullSets[i]);
+                if (verbose) {
+                    std::lock_guard<std::mutex> lock(logLock);
+                    std::cerr << "Loaded " << inPaths[i] << std::endl;
+                }
+            });
+        }
+        pool.Wait();
+    }
+    for (size_t i = 0; i < setCount; i++) {
+        if (fstats != nullptr) {
+            fprintf(fstats,"%s\t%lu\n", inPaths[i].c_str(), kh_size(fullSets[i]));
+            fputs(loadedDiagnostics[i].c_str(), fstats);
+        }
+    }
+
+    if (verbose) {
+        std::cerr << "===================" << std::endl;
+        std::cerr << "2) Computing result" << std::endl;
+        std::cerr << "===================" << std::endl;
+    }
+    KHT* result = KMerTable<KHT>::Init();
+    getSetOperation(result, fullSets, operation, quorum, threads);
+    for (auto &&kMers : fullSets) KMerTable<KHT>::Destroy(kMers);
+    size_t resultSize = kh_size(result);
+    if (verbose) {
+        std::cerr << "   result size: " << resultSize << std::endl;
+    }
+    if (fstats != nullptr) {
+        fprintf(fstats,"%s\t%lu\n", outPath.c_str(), resultSize);
+        if (diagnostics) fputs(FormatTableDiagnostics(outPath, "computed", result).c_str(), fstats);
+    }
+
+    if (verbose) {
+        std::cerr << "=============" << std::endl;
+        std::cerr << "3) Assembling" << std::endl;
+        std::cerr << "=============" << std::endl;
+    }
+    FastaWriter writer(outPath, lineWidth);
+    int simplitigCount = ComputeSimplitigs(result, writer, k, complements, threads);
+    writer.Close();
+    if (verbose) {
+        std::cerr << "   assembly of " << outPath << " finished (" << simplitigCount << " contigs)" << std::endl;
+    }
+    if (fstats != nullptr) {
+        if (diagnostics) fputs(FormatTableDiagnostics(outPath, "assembled", result).c_str(), fstats);
+        fclose(fstats);
+    }
+    KMerTable<KHT>::Destroy(result);
+    return 0;
+}
+
+/// Load the k-mer sets into a single table with the sets containing each k-mer and return their sizes.
+/// Each set is loaded to a table of its own first, which is merged into the single table and freed,
+/// so up to one full set per running task is in memory next to the single table.
+/// The sets are loaded in parallel, but merged one at a time, since the single table is not locked otherwise.
+template <typename KHT>
+std::vector<size_t> loadMembership(KMerMembership<KMerOf<KHT>> &membership,
+    TaskPool &pool,
+    int32_t k,
+    std::vector<std::string> &inPaths,
+    bool complements,
+    byte minimumAbundance,
+    bool presize,
+    const std::function<void(const std::string &)> &log) {
+
+    std::mutex membershipLock;
+    std::vector<size_t> inSizes(inPaths.size());
+    for (size_t i = 0; i < inPaths.size(); i++) {
+        pool.Submit({LOAD_STEP, FileSize(inPaths[i])}, [&, i] {
+            KHT* kMers = KMerTable<KHT>::Init();
+            ReadKMers(kMers, inPaths[i], k, complements, pool.ThreadsPerTask(), presize);
+            removeRareKMers(kMers, minimumAbundance);
+            inSizes[i] = kh_size(kMers);
+            {
+                std::lock_guard<std::mutex> lock(membershipLock);
+                membership.AddSet(i, kMers);
+            }
+            KMerTable<KHT>::Destroy(kMers);
+            log("Loaded " + inPaths[i]);
+        });
+    }
+    pool.Wait();
+    log("   distinct k-mers: " + std::to_string(membership.Size()));
+    return inSizes;
+}
+
+/// Compute the intersection and the remainders of the sets from a single table of all the k-mers
+/// with the sets containing each of them, which takes memory for the distinct k-mers of all the sets only.
+/// The intersection and each remainder are selected from the single table and assembled by a task of their own.
+template <typename KHT>
+int runMembership(int32_t k,
+    std::string intersectionPath,
+    std::vector<std::string> inPaths,
+    std::vector<std::string> outPaths,
+    FILE *fstats,
+    bool computeOutput,
+    bool verbose,
+    bool complements,
+    byte minimumAbundance,
+    int threads,
+    size_t setCount,
+    bool presize,
+    int lineWidth) {
+
+    std::mutex logLock;
+    auto log = [&](const std::string &message) {
+        if (!verbose) return;
+        std::lock_guard<std::mutex> lock(logLock);
+        std::cerr << message << std::endl;
+    };
+    if (verbose) {
+        std::cerr << "=====================" << std::endl;
+        std::cerr << "1) Loading references" << std::endl;
+        std::cerr << "=====================" << std::endl;
+    }
+    KMerMembership<KMerOf<KHT>> membership(setCount);
+    TaskPool pool(threads);
+    std::vector<size_t> inSizes = loadMembership<KHT>(membership, pool, k, inPaths, complements, minimumAbundance, presize, log);
+    std::vector<size_t> outSizes(setCount);
+    if (fstats != nullptr) {
+        for (size_t i = 0; i < setCount; i++) fprintf(fstats,"%s\t%lu\n", inPaths[i].c_str(), inSizes[i]);
+    }
+
+    if (verbose) {
+        std::string title = computeOutput ? "2) Intersecting, subtracting and assembling" : "2) Intersecting and assembling";
+        std::cerr << std::string(title.size(), '=') << std::endl;
+        std::cerr << title << std::endl;
+        std::cerr << std::string(title.size(), '=') << std::endl;
+    }
+    /* The selected sets are freed as soon as they are assembled, so that only the running tasks hold one. */
+    auto assemble = [&](const std::string &path, KHT *kMers) {
+        FastaWriter writer(path, lineWidth);
+        int simplitigCount = ComputeSimplitigs(kMers, writer, k, complements, pool.ThreadsPerTask());
+        writer.Close();
+        KMerTable<KHT>::Destroy(kMers);
+        log("   assembly of " + path + " finished (" + std::to_string(simplitigCount) + " contigs)");
+    };
+    size_t intersectionSize = 0;
+    pool.Submit({ASSEMBLE_STEP, 0}, [&] {
+        KHT* intersection = KMerTable<KHT>::Init();
+        membership.Select(intersection, [&](const uint64_t *bitmap) { return membership.InAllSets(bitmap); }, pool.ThreadsPerTask());
+        intersectionSize = kh_size(intersection);
+        log("   intersection size: " + std::to_string(intersectionSize));
+        assemble(intersectionPath, intersection);
+    });
+    for (size_t i = 0; computeOutput && i < setCount; i++) {
+        pool.Submit({ASSEMBLE_STEP, inSizes[i]}, [&, i] {
+            KHT* kMers = KMerTable<KHT>::Init();
+            membership.Select(kMers, [&](const uint64_t *bitmap) {
+                return membership.Contains(bitmap, i) && !membership.InAllSets(bitmap);
+            }, pool.ThreadsPerTask());
+            outSizes[i] = kh_size(kMers);
+            assemble(outPaths[i], kMers);
+        });
+    }
+    pool.Wait();
+
+    for (size_t i = 0; computeOutput && i < setCount; i++) {
+        if (inSizes[i] != outSizes[i] + intersectionSize) {
+            std::cerr << "Internal error: k-mer set sizes do not correspond "
+                << inSizes[i] << " != " << outSizes[i] << " + " << intersectionSize << std::endl;
+            return 1;
+        }
+    }
+    if (fstats) {
+        if (computeOutput) {
+            for (size_t i = 0; i < setCount; i++) fprintf(fstats,"%s\t%lu\n", outPaths[i].c_str(), outSizes[i]);
+        }
+        fprintf(fstats,"%s\t%lu\n", intersectionPath.c_str(), intersectionSize);
+        fclose(fstats);
+    }
+    return 0;
+}
+
+/// Group the k-mers of all the sets by the exact subset of the sets containing them, which is their color class,
+/// and assemble each class by a task of its own into a single file, with the records named CLASS_SIMPLITIG.
+/// The inputs of each class are written to the color table next to it.
+/// The single table of all the k-mers is freed once the classes are split, so that the classes take its place.
+template <typename KHT>
+int runColors(int32_t k,
+    std::vector<std::string> inPaths,
+    std::string colorsPath,
+    FILE *fstats,
+    bool verbose,
+    bool complements,
+    byte minimumAbundance,
+    int threads,
+    size_t setCount,
+    bool presize,
+    int lineWidth) {
+
+    std::mutex logLock;
+    auto log = [&](const std::string &message) {
+        if (!verbose) return;
+        std::lock_guard<std::mutex> lock(logLock);
+        std::cerr << message << std::endl;
+    };
+    if (verbose) {
+        std::cerr << "=====================" << std::endl;
+        std::cerr << "1) Loading references" << std::endl;
+        std::cerr << "=====================" << std::endl;
+    }
+    TaskPool pool(threads);
+    std::vector<std::vector<uint64_t>> colors;
+    std::vector<KHT*> classes;
+    {
+        KMerMembership<KMerOf<KHT>> membership(setCount);
+        std::vector<size_t> inSizes = loadMembership<KHT>(membership, pool, k, inPaths, complements, minimumAbundance, presize, log);
+        if (fstats != nullptr) {
+            for (size_t i = 0; i < setCount; i++) fprintf(fstats,"%s\t%lu\n", inPaths[i].c_str(), inSizes[i]);
+        }
+        classes = membership.template SplitByColor<KHT>(colors, threads);
+    }
+    size_t kMerCount = 0;
+    for (auto &&kMers : classes) kMerCount += kh_size(kMers);
+    log("   color classes: " + std::to_string(classes.size()));
+
+    std::string tablePath = colorsPath + ".colors";
+    FILE *table = fopen(tablePath.c_str(), "w");
+    TestFile(table, tablePath);
+    for (size_t i = 0; i < setCount; i++) fprintf(table, "# input\t%zu\t%s\n", i, inPaths[i].c_str());
+    fprintf(table, "# class\tkmers\tinputs\n");
+    for (size_t c = 0; c < classes.size(); c++) {
+        std::string inputs;
+        for (size_t i = 0; i < setCount; i++) {
+            if (!KMerMembership<KMerOf<KHT>>::Contains(colors[c].data(), i)) continue;
+            inputs += (inputs.empty() ? "" : ",") + std::to_string(i);
+        }
+        fprintf(table, "%zu\t%zu\t%s\n", c, (size_t)kh_size(classes[c]), inputs.c_str());
+    }
+    fclose(table);
+
+    if (verbose) {
+        std::cerr << "=============" << std::endl;
+        std::cerr << "2) Assembling" << std::endl;
+        std::cerr << "=============" << std::endl;
+    }
+    /* The classes share the output, to which their simplitigs are written in blocks under the lock,
+     * so the order of the simplitigs is not deterministic. */
+    FastaWriter writer(colorsPath, lineWidth);
+    std::mutex writerLock;
+    std::atomic<size_t> simplitigCount(0);
+    for (size_t c = 0; c < classes.size(); c++) {
+        pool.Submit({ASSEMBLE_STEP, kh_size(classes[c])}, [&, c] {
+            simplitigCount += ComputeSimplitigs(classes[c], writer, k, complements, pool.ThreadsPerTask(),
+                    std::to_string(c) + "_", &writerLock);
+            KMerTable<KHT>::Destroy(classes[c]);
+        });
+    }
+    pool.Wait();
+    writer.Close();
+    log("   assembly of " + colorsPath + " finished (" + std::to_string(simplitigCount) + " contigs)");
+    if (fstats) {
+        fprintf(fstats,"%s\t%zu\n", colorsPath.c_str(), kMerCount);
+        fclose(fstats);
+    }
+    return 0;
+}
+
+/// Save the k-mer set of each input to a snapshot.
+/// All the k-mers are kept with their abundances, so that the snapshots can be used with any minimum abundance.
+template <typename KHT>
+int runIndex(int32_t k,
+    std::vector<std::string> inPaths,
+    std::vector<std::string> outPaths,
+    bool verbose,
+    bool complements,
+    int threads,
+    size_t setCount,
+    bool presize) {
+
+    for (size_t i = 0; i < setCount; i++) {
+        KHT* kMers = KMerTable<KHT>::Init();
+        ReadKMers(kMers, inPaths[i], k, complements, threads, presize);
+        SaveSnapshot(kMers, outPaths[i], k, complements);
+        if (verbose) {
+            std::cerr << "Indexed " << inPaths[i] << " to " << outPaths[i] << " (" << kh_size(kMers) << " k-mers)"
+                << std::endl;
+        }
+        KMerTable<KHT>::Destroy(kMers);
+    }
+    return 0;
+}
+
+/// Run the computation on disk-backed partitions of the k-mer sets.
+/// The k-mers are first split into partition files according to their minimizers. Then all the sets are
+/// loaded, intersected, subtracted and assembled one partition at a time. The simplitigs of the partitions
+/// are finally joined where they were cut by the partition boundaries.
+template <typename KHT>
+int runPartitioned(int32_t k,
+    std::string intersectionPath,
+    std::vector<std::string> inPaths,
+    std::vector<std::string> outPaths,
+    FILE *fstats,
+    bool computeIntersection,
+    bool computeOutput,
+    bool verbose,
+    bool complements,
+    byte minimumAbundance,
+    int threads,
+    size_t setCount,
+    size_t partitionCount,
+    std::string temporaryDirectory,
+    int lineWidth) {
+
+    if (verbose) {
+        std::cerr << "=========================" << std::endl;
+        std::cerr << "1) Partitioning references" << std::endl;
+        std::cerr << "=========================" << std::endl;
+    }
+    std::string directory = MakeTemporaryDirectory(temporaryDirectory);
+    for (size_t i = 0; i < setCount; i++) {
+        PartitionFasta<KMerOf<KHT>>(inPaths[i], directory, i, partitionCount, k, complements, minimumAbundance, threads);
+        if (verbose) {
+            std::cerr << "Partitioned " << inPaths[i] << " into " << partitionCount << " partitions" << std::endl;
+        }
+    }
+
+    if (verbose) {
+        std::cerr << "=============================================" << std::endl;
+        std::cerr << "2) Intersecting and assembling the partitions" << std::endl;
+        std::cerr << "=============================================" << std::endl;
+    }
+    /* The simplitigs of each output are collected in a temporary file before they are joined. */
+    std::vector<std::string> fragmentPaths(setCount + 1);
+    std::vector<std::ofstream> fragments(setCount + 1);
+    for (size_t i = 0; i <= setCount; i++) {
+        fragmentPaths[i] = directory + "/" + std::to_string(i) + ".fa";
+        bool used = i < setCount ? computeOutput : computeIntersection;
+        if (used) fragments[i] = std::ofstream(fragmentPaths[i]);
+    }
+    std::vector<size_t> inSizes(setCount), outSizes(setCount);
+    size_t intersectionSize = 0;
+    int setThreads = std::min(threads, (int)setCount);
+    int threadsPerSet = std::max(1, threads / setThreads);
+    for (size_t p = 0; p < partitionCount; p++) {
+        std::vector<KHT*> fullSets(setCount);
+        ParallelFor(setThreads, setCount, [&](long i, int _) {
+            fullSets[i] = KMerTable<KHT>::Init();
+            LoadPartition(fullSets[i], PartitionPath(directory, i, p));
+            removeRareKMers(fullSets[i], minimumAbundance);
+        });
+        for (size_t i = 0; i < setCount; i++) inSizes[i] += kh_size(fullSets[i]);
+        KHT* intersection = KMerTable<KHT>::Init();
+        if (computeIntersection) {
+            getIntersection(intersection, fullSets, threads);
+            intersectionSize += kh_size(intersection);
+            if (computeOutput) {
+                DifferenceInPlaceData<KHT> data = {fullSets, intersection};
+                kt_for(setThreads, DifferenceInPlaceThread<KHT>, (void*)&data, setCount);
+            }
+        }
+        if (computeOutput) {
+            std::vector<std::ostream*> ofs(setCount);
+            for (size_t i = 0; i < setCount; i++) {
+                outSizes[i] += kh_size(fullSets[i]);
+                ofs[i] = &fragments[i];
+            }
+            ComputeSimplitigsData<KHT> data = {fullSets, ofs, k, complements, std::vector<int>(setCount),
+                                                   threadsPerSet};
+            kt_for(setThreads, ComputeSimplitigsThread<KHT>, (void*)&data, setCount);
+        }
+        if (computeIntersection) {
+            ComputeSimplitigs(intersection, fragments[setCount], k, complements, threads);
+        }
+        for (auto &&kMers : fullSets) KMerTable<KHT>::Destroy(kMers);
+        KMerTable<KHT>::Destroy(intersection);
+        if (verbose) {
+            std::cerr << "   partition " << p + 1 << "/" << partitionCount << " finished" << std::endl;
+        }
+    }
+    for (auto &&fragment : fragments) if (fragment.is_open()) fragment.close();
+
+    for (size_t i = 0; i < setCount; i++) {
+        if (fstats != nullptr) {
+            fprintf(fstats,"%s\t%lu\n", inPaths[i].c_str(), inSizes[i]);
+        }
+        if (computeOutput && inSizes[i] != outSizes[i] + intersectionSize) {
+            std::cerr << "Internal error: k-mer set sizes do not correspond "
+                << inSizes[i] << " != " << outSizes[i] << " + " << intersectionSize << std::endl;
+            return 1;
+        }
+    }
+    if (verbose) {
+        std::cerr << "==========================================" << std::endl;
+        std::cerr << "3) Joining simplitigs across the partitions" << std::endl;
+        std::cerr << "==========================================" << std::endl;
+    }
+    for (size_t i = 0; i <= setCount; i++) {
+        bool isIntersection = i == setCount;
+        if (isIntersection ? !computeIntersection : !computeOutput) continue;
+        std::string path = isIntersection ? intersectionPath : outPaths[i];
+        FastaWriter of(path, lineWidth);
+        if (fstats) {
+            fprintf(fstats,"%s\t%lu\n", path.c_str(), isIntersection ? intersectionSize : outSizes[i]);
+        }
+        int simplitigCount = GlueSimplitigs<KMerOf<KHT>>(fragmentPaths[i], of, k, complements);
+        of.Close();
+        remove(fragmentPaths[i].c_str());
+        if (verbose) {
+            std::cerr << "   assembly finished (" << simplitigCount << " contigs)" << std::endl;
+        }
+    }
+    rmdir(directory.c_str());
+    if (fstats){
+        fclose(fstats);
+    }
+    return 0;
+}
+
 
 int main(int argc, char **argv) {
     int32_t k = -1;
@@ -214,14 +809,38 @@ int main(int argc, char **argv) {
     bool computeOutput = false;
     bool verbose = true;
     bool complements = true;
+    bool lowMemory = false;
+    bool presize = false;
+    bool diagnostics = false;
+    bool computeSetOperation = false;
+    bool sharedTable = false;
+    bool computeColors = false;
+    std::string colorsPath;
+    SetOperation setOperation = UNION_OPERATION;
+    size_t quorum = 0;
     int threads = 1;
+    byte minimumAbundance = 1;
+    int lineWidth = 0;
+    size_t maxMemory = 0;
+    std::string temporaryDirectory = getenv("TMPDIR") != nullptr ? getenv("TMPDIR") : "/tmp";
 
     if (argc<2) {
         Help();
         return 1;
     }
+    bool index = std::string(argv[1]) == "index";
+    if (index) {
+        argc--;
+        argv++;
+    }
+    const int TMP_DIR_OPTION = 256;
+    const struct option longOptions[] = {
+        {"max-memory", required_argument, nullptr, 'M'},
+        {"tmp-dir", required_argument, nullptr, TMP_DIR_OPTION},
+        {nullptr, 0, nullptr, 0},
+    };
     int c;
-    while ((c = getopt(argc, (char *const *)argv, "hSi:o:x:s:k:uvt:m:")) >= 0) {
+    while ((c = getopt_long(argc, (char *const *)argv, "hSi:o:x:a:cC:s:Dk:uvt:m:LeM:w:", longOptions, nullptr)) >= 0) {
         switch (c) {
             case 'h': {
                 return Help();
@@ -240,6 +859,23 @@ int main(int argc, char **argv) {
                 computeIntersection = true;
                 break;
             }
+            case 'a': {
+                if (!ParseSetOperation(optarg, setOperation, quorum)) {
+                    std::cerr << "Set operation must be union, difference, symdiff or a positive number of sets." << std::endl;
+                    return Help();
+                }
+                computeSetOperation = true;
+                break;
+            }
+            case 'c': {
+                sharedTable = true;
+                break;
+            }
+            case 'C': {
+                colorsPath = std::string(optarg);
+                computeColors = true;
+                break;
+            }
             case 's': {
                 statsPath=std::string(optarg);
                 if (statsPath == "-") {
@@ -250,6 +886,10 @@ int main(int argc, char **argv) {
                 }
                 break;
             }
+            case 'D': {
+                diagnostics = true;
+                break;
+            }
             case 'S': {
                 verbose = false;
                 break;
@@ -268,13 +908,41 @@ int main(int argc, char **argv) {
                     std::cerr << "Minimum abundance must be between 1 and 255." << std::endl;
                     return Help();
                 }
-                MINIMUM_ABUNDANCE = (byte) iarg;
+                minimumAbundance = (byte) iarg;
                 break;
             }
             case 'u': {
                 complements = false;
                 break;
             }
+            case 'L': {
+                lowMemory = true;
+                break;
+            }
+            case 'e': {
+                presize = true;
+                break;
+            }
+            case 'w': {
+                lineWidth = atoi(optarg);
+                if (lineWidth < 1) {
+                    std::cerr << "Line width must be at least 1." << std::endl;
+                    return Help();
+                }
+                break;
+            }
+            case 'M': {
+                maxMemory = ParseMemorySize(optarg);
+                if (maxMemory == 0) {
+                    std::cerr << "Memory budget must be a positive size, e.g. 64G." << std::endl;
+                    return Help();
+                }
+                break;
+            }
+            case TMP_DIR_OPTION: {
+                temporaryDirectory = std::string(optarg);
+                break;
+            }
             case 'v': {
                 Version();
                 return 0;
@@ -293,7 +961,18 @@ int main(int argc, char **argv) {
         return Help();
     }
     size_t setCount = inPaths.size();
-    if (computeOutput && (outPaths.size() != setCount)) {
+    if (computeColors) {
+        if (computeOutput || computeIntersection || computeSetOperation || sharedTable || lowMemory || maxMemory > 0
+                || index || colorsPath == "-") {
+            std::cerr << "Color classes (-C) require a file and do not support -o, -x, -a, -c, -L, -M and index." << std::endl;
+            return Help();
+        }
+    } else if (computeSetOperation) {
+        if (outPaths.size() != 1 || computeIntersection || lowMemory || maxMemory > 0 || index) {
+            std::cerr << "Set operation (-a) requires exactly one -o and does not support -x, -L, -M and index." << std::endl;
+            return Help();
+        }
+    } else if (computeOutput && (outPaths.size() != setCount)) {
         std::cerr << "If -o is used, it must be used as many times as -i (" << setCount << "!=" << outPaths.size() << ")." << std::endl;
         return Help();
     }
@@ -305,14 +984,35 @@ int main(int argc, char **argv) {
         std::cerr << "At least one input set must be provided." << std::endl;
         return Help();
     }
+    if (lowMemory && (!computeIntersection || computeOutput)) {
+        std::cerr << "Low-memory mode (-L) can only be used with -x and without -o." << std::endl;
+        return Help();
+    }
+    if (sharedTable && (!computeIntersection || lowMemory || maxMemory > 0 || computeSetOperation || index)) {
+        std::cerr << "Single table mode (-c) requires -x and does not support -a, -L, -M and index." << std::endl;
+        return Help();
+    }
     if (threads < 1) {
         std::cerr << "Number of threads must be at least 1." << std::endl;
         return Help();
     }
-    // Flooring the number of threads to the number of sets.
-    if (setCount < size_t(threads)) {
-        threads = setCount;
-        std::cerr << "Number of threads is greater than the number of input sets. Using " << threads << " threads instead." << std::endl;
+    if (diagnostics && !fstats) {
+        std::cerr << "Hash table diagnostics (-D) are written to the statistics file, which requires -s." << std::endl;
+        return Help();
+    }
+    if (index) {
+        if (!computeOutput || computeIntersection || lowMemory || maxMemory > 0 || fstats) {
+            std::cerr << "Index requires -o for each -i and does not support -x, -s, -L and -M." << std::endl;
+            return Help();
+        }
+        /* The tables with values count the abundances; snapshots always store khash tables. */
+        if (k <= 32) {
+            return runIndex<kh_S64M_t>(k, inPaths, outPaths, verbose, complements, threads, setCount, presize);
+        } else if (k <= 64) {
+            return runIndex<kh_S128M_t>(k, inPaths, outPaths, verbose, complements, threads, setCount, presize);
+        } else {
+            return runIndex<kh_S256M_t>(k, inPaths, outPaths, verbose, complements, threads, setCount, presize);
+        }
     }
 
     if (fstats) {
@@ -322,16 +1022,129 @@ int main(int argc, char **argv) {
         }
         fprintf(fstats,"\n");
     }
+    recordRehashes = diagnostics;
+
+    if (computeColors) {
+        if (diagnostics) {
+            std::cerr << "Warning: hash table diagnostics are not collected for the color classes." << std::endl;
+        }
+        if (k <= 32) {
+            if (minimumAbundance == (byte)1) {
+                return runColors<KMerSet64>(k, inPaths, colorsPath, fstats, verbose, complements, minimumAbundance, threads, setCount, presize, lineWidth);
+            } else {
+                return runColors<KMerMap64>(k, inPaths, colorsPath, fstats, verbose, complements, minimumAbundance, threads, setCount, presize, lineWidth);
+            }
+        } else if (k <= 64) {
+            if (minimumAbundance == (byte)1) {
+                return runColors<KMerSet128>(k, inPaths, colorsPath, fstats, verbose, complements, minimumAbundance, threads, setCount, presize, lineWidth);
+            } else {
+                return runColors<KMerMap128>(k, inPaths, colorsPath, fstats, verbose, complements, minimumAbundance, threads, setCount, presize, lineWidth);
+            }
+        } else {
+            if (minimumAbundance == (byte)1) {
+                return runColors<KMerSet256>(k, inPaths, colorsPath, fstats, verbose, complements, minimumAbundance, threads, setCount, presize, lineWidth);
+            } else {
+                return runColors<KMerMap256>(k, inPaths, colorsPath, fstats, verbose, complements, minimumAbundance, threads, setCount, presize, lineWidth);
+            }
+        }
+    }
+    if (sharedTable) {
+        if (diagnostics) {
+            std::cerr << "Warning: hash table diagnostics are not collected in the single table mode." << std::endl;
+        }
+        if (k <= 32) {
+            if (minimumAbundance == (byte)1) {
+                return runMembership<KMerSet64>(k, intersectionPath, inPaths, outPaths, fstats, computeOutput, verbose, complements, minimumAbundance, threads, setCount, presize, lineWidth);
+            } else {
+                return runMembership<KMerMap64>(k, intersectionPath, inPaths, outPaths, fstats, computeOutput, verbose, complements, minimumAbundance, threads, setCount, presize, lineWidth);
+            }
+        } else if (k <= 64) {
+            if (minimumAbundance == (byte)1) {
+                return runMembership<KMerSet128>(k, intersectionPath, inPaths, outPaths, fstats, computeOutput, verbose, complements, minimumAbundance, threads, setCount, presize, lineWidth);
+            } else {
+                return runMembership<KMerMap128>(k, intersectionPath, inPaths, outPaths, fstats, computeOutput, verbose, complements, minimumAbundance, threads, setCount, presize, lineWidth);
+            }
+        } else {
+            if (minimumAbundance == (byte)1) {
+                return runMembership<KMerSet256>(k, intersectionPath, inPaths, outPaths, fstats, computeOutput, verbose, complements, minimumAbundance, threads, setCount, presize, lineWidth);
+            } else {
+                return runMembership<KMerMap256>(k, intersectionPath, inPaths, outPaths, fstats, computeOutput, verbose, complements, minimumAbundance, threads, setCount, presize, lineWidth);
+            }
+        }
+    }
+
+    if (computeSetOperation) {
+        if (k <= 32) {
+            if (minimumAbundance == (byte)1) {
+                return runSetOperation<KMerSet64>(k, inPaths, outPaths[0], fstats, verbose, complements, minimumAbundance, threads, setCount, presize, diagnostics, setOperation, quorum, lineWidth);
+            } else {
+                return runSetOperation<KMerMap64>(k, inPaths, outPaths[0], fstats, verbose, complements, minimumAbundance, threads, setCount, presize, diagnostics, setOperation, quorum, lineWidth);
+            }
+        } else if (k <= 64) {
+            if (minimumAbundance == (byte)1) {
+                return runSetOperation<KMerSet128>(k, inPaths, outPaths[0], fstats, verbose, complements, minimumAbundance, threads, setCount, presize, diagnostics, setOperation, quorum, lineWidth);
+            } else {
+                return runSetOperation<KMerMap128>(k, inPaths, outPaths[0], fstats, verbose, complements, minimumAbundance, threads, setCount, presize, diagnostics, setOperation, quorum, lineWidth);
+            }
+        } else {
+            if (minimumAbundance == (byte)1) {
+                return runSetOperation<KMerSet256>(k, inPaths, outPaths[0], fstats, verbose, complements, minimumAbundance, threads, setCount, presize, diagnostics, setOperation, quorum, lineWidth);
+            } else {
+                return runSetOperation<KMerMap256>(k, inPaths, outPaths[0], fstats, verbose, complements, minimumAbundance, threads, setCount, presize, diagnostics, setOperation, quorum, lineWidth);
+            }
+        }
+    }
+
+    size_t partitionCount = 1;
+    if (maxMemory > 0 && !lowMemory) {
+        partitionCount = PartitionCount(inPaths, k, minimumAbundance, maxMemory, computeIntersection);
+        if (partitionCount > MAX_PARTITIONS) {
+            partitionCount = MAX_PARTITIONS;
+            std::cerr << "Warning: the memory budget is likely to be exceeded even with " << partitionCount << " partitions." << std::endl;
+        }
+    }
+    if (partitionCount > 1) {
+        if (diagnostics) {
+            std::cerr << "Warning: hash table diagnostics are not collected in the partitioned mode." << std::endl;
+        }
+        if (k <= 32) {
+            if (minimumAbundance == (byte)1) {
+                return runPartitioned<KMerSet64>(k, intersectionPath, inPaths, outPaths, fstats, computeIntersection, computeOutput, verbose, complements, minimumAbundance, threads, setCount, partitionCount, temporaryDirectory, lineWidth);
+            } else {
+                return runPartitioned<KMerMap64>(k, intersectionPath, inPaths, outPaths, fstats, computeIntersection, computeOutput, verbose, complements, minimumAbundance, threads, setCount, partitionCount, temporaryDirectory, lineWidth);
+            }
+        } else if (k <= 64) {
+            if (minimumAbundance == (byte)1) {
+                return runPartitioned<KMerSet128>(k, intersectionPath, inPaths, outPaths, fstats, computeIntersection, computeOutput, verbose, complements, minimumAbundance, threads, setCount, partitionCount, temporaryDirectory, lineWidth);
+            } else {
+                return runPartitioned<KMerMap128>(k, intersectionPath, inPaths, outPaths, fstats, computeIntersection, computeOutput, verbose, complements, minimumAbundance, threads, setCount, partitionCount, temporaryDirectory, lineWidth);
+            }
+        } else {
+            if (minimumAbundance == (byte)1) {
+                return runPartitioned<KMerSet256>(k, intersectionPath, inPaths, outPaths, fstats, computeIntersection, computeOutput, verbose, complements, minimumAbundance, threads, setCount, partitionCount, temporaryDirectory, lineWidth);
+            } else {
+                return runPartitioned<KMerMap256>(k, intersectionPath, inPaths, outPaths, fstats, computeIntersection, computeOutput, verbose, complements, minimumAbundance, threads, setCount, partitionCount, temporaryDirectory, lineWidth);
+            }
+        }
+    }
 
     if (k <= 32) {
-        if (MINIMUM_ABUNDANCE == (byte)1) {
-            return run64S(k, intersectionPath, inPaths, outPaths, statsPath, fstats, computeIntersection, computeOutput, verbose, complements, threads, setCount);
+        if (minimumAbundance == (byte)1) {
+            return run<KMerSet64>(k, intersectionPath, inPaths, outPaths, statsPath, fstats, computeIntersection, computeOutput, verbose, complements, minimumAbundance, threads, setCount, lowMemory, presize, diagnostics, maxMemory, lineWidth);
         } else {
-            return run64M(k, intersectionPath, inPaths, outPaths, statsPath, fstats, computeIntersection, computeOutput, verbose, complements, threads, setCount);
+            return run<KMerMap64>(k, intersectionPath, inPaths, outPaths, statsPath, fstats, computeIntersection, computeOutput, verbose, complements, minimumAbundance, threads, setCount, lowMemory, presize, diagnostics, maxMemory, lineWidth);
         }
     } else if (k <= 64) {
-        return run128M(k, intersectionPath, inPaths, outPaths, statsPath, fstats, computeIntersection, computeOutput, verbose, complements, threads, setCount);
+        if (minimumAbundance == (byte)1) {
+            return run<KMerSet128>(k, intersectionPath, inPaths, outPaths, statsPath, fstats, computeIntersection, computeOutput, verbose, complements, minimumAbundance, threads, setCount, lowMemory, presize, diagnostics, maxMemory, lineWidth);
+        } else {
+            return run<KMerMap128>(k, intersectionPath, inPaths, outPaths, statsPath, fstats, computeIntersection, computeOutput, verbose, complements, minimumAbundance, threads, setCount, lowMemory, presize, diagnostics, maxMemory, lineWidth);
+        }
     } else {
-        return run256M(k, intersectionPath, inPaths, outPaths, statsPath, fstats, computeIntersection, computeOutput, verbose, complements, threads, setCount);
+        if (minimumAbundance == (byte)1) {
+            return run<KMerSet256>(k, intersectionPath, inPaths, outPaths, statsPath, fstats, computeIntersection, computeOutput, verbose, complements, minimumAbundance, threads, setCount, lowMemory, presize, diagnostics, maxMemory, lineWidth);
+        } else {
+            return run<KMerMap256>(k, intersectionPath, inPaths, outPaths, statsPath, fstats, computeIntersection, computeOutput, verbose, complements, minimumAbundance, threads, setCount, lowMemory, presize, diagnostics, maxMemory, lineWidth);
+        }
     }
 }
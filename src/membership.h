@@ -0,0 +1,219 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "khash_utils.h"
+
+/// Tables of k-mers with their membership bitmap, or its row if it does not fit into a single word.
+KHASH_MAP_INIT_INT256(S256C, uint64_t)
+KHASH_MAP_INIT_INT128(S128C, uint64_t)
+KHASH_MAP_INIT_INT64(S64C, uint64_t)
+
+/// Operations of the table of k-mers with their membership for the k-mer type kmer_t.
+template <typename kmer_t>
+struct MembershipTable;
+
+#define INIT_MEMBERSHIP_TABLE(type, variant)                                                                        \
+template <>                                                                                                         \
+struct MembershipTable<kmer##type##_t> {                                                                            \
+    typedef kh_S##variant##_t table_t;                                                                              \
+    static inline table_t *Init() { return kh_init_S##variant(); }                                                  \
+    static inline void Destroy(table_t *kMers) { kh_destroy_S##variant(kMers); }                                    \
+    static inline khint_t Put(table_t *kMers, kmer##type##_t kMer, int *ret) {                                      \
+        return kh_put_S##variant(kMers, kMer, ret);                                                                 \
+    }                                                                                                               \
+    static inline khint_t Get(table_t *kMers, kmer##type##_t kMer) { return kh_get_S##variant(kMers, kMer); }       \
+    static inline khint_t Hash(kmer##type##_t kMer) { return (khint_t)kh_int##type##_hash_func(kMer); }             \
+    /* The bitmap is prefetched with the key, since it is updated right after the lookup. */                        \
+    static inline void Prefetch(table_t *kMers, khint_t hash) {                                                     \
+        if (!kMers->n_buckets) return;                                                                              \
+        khashPrefetchBucket(kMers, hash);                                                                           \
+        __builtin_prefetch(&kMers->vals[hash & (kMers->n_buckets - 1)]);                                            \
+    }                                                                                                               \
+};
+
+INIT_MEMBERSHIP_TABLE(64, 64C)
+INIT_MEMBERSHIP_TABLE(128, 128C)
+INIT_MEMBERSHIP_TABLE(256, 256C)
+
+/// The k-mers of several sets in a single table, with a bitmap of the sets containing each k-mer.
+/// A k-mer shared by many sets is stored only once, so that the memory scales with the distinct k-mers
+/// of all the sets rather than with the sum of their sizes. The bitmap has a bit per set; up to 64 sets,
+/// it is stored with the k-mer, and otherwise the k-mer stores the row of its bitmap in a separate array.
+template <typename kmer_t>
+class KMerMembership {
+public:
+    typedef MembershipTable<kmer_t> Table;
+
+    explicit KMerMembership(size_t setCount) : setCount(setCount), words((setCount + 63) / 64), kMers(Table::Init()) {}
+
+    KMerMembership(const KMerMembership &) = delete;
+    KMerMembership &operator=(const KMerMembership &) = delete;
+
+    ~KMerMembership() {
+        Table::Destroy(kMers);
+    }
+
+    /// Number of distinct k-mers of all the sets.
+    size_t Size() const {
+        return kh_size(kMers);
+    }
+
+    /// Add the k-mers of the set with the given index, which are canonical already.
+    /// The k-mers are added in batches whose buckets are prefetched first.
+    template <typename KHT>
+    void AddSet(size_t set, KHT *kMerSet) {
+        uint64_t bit = uint64_t(1) << (set % 64);
+        kmer_t batch[INTERSECTION_BATCH_SIZE];
+        for (auto i = kh_begin(kMerSet); i != kh_end(kMerSet); ) {
+            size_t batchSize = 0;
+            for (; i != kh_end(kMerSet) && batchSize < INTERSECTION_BATCH_SIZE; ++i) {
+                if (!isKMerAt(kMerSet, i)) continue;
+                batch[batchSize] = kh_key(kMerSet, i);
+                Table::Prefetch(kMers, Table::Hash(batch[batchSize++]));
+            }
+            for (size_t b = 0; b < batchSize; ++b) {
+                int ret;
+                khint_t index = Table::Put(kMers, batch[b], &ret);
+                if (ret) {
+                    kh_val(kMers, index) = words == 1 ? 0 : bitmaps.size() / words;
+                    if (words > 1) bitmaps.resize(bitmaps.size() + words);
+                }
+                uint64_t *bitmap = words == 1 ? &kh_val(kMers, index) : &bitmaps[kh_val(kMers, index) * words];
+                bitmap[set / 64] |= bit;
+            }
+        }
+    }
+
+    /// Number of sets in the bitmap.
+    size_t Count(const uint64_t *bitmap) const {
+        size_t count = 0;
+        for (size_t word = 0; word < words; ++word) count += __builtin_popcountll(bitmap[word]);
+        return count;
+    }
+
+    /// Determine whether the set with the given index is in the bitmap.
+    static bool Contains(const uint64_t *bitmap, size_t set) {
+        return (bitmap[set / 64] >> (set % 64)) & 1;
+    }
+
+    /// Determine whether all the sets are in the bitmap.
+    bool InAllSets(const uint64_t *bitmap) const {
+        return Count(bitmap) == setCount;
+    }
+
+    /// Insert the k-mers whose bitmaps satisfy the predicate into the k-mer set.
+    /// The buckets are split among the threads, which collect the k-mers first, so that the set is not locked.
+    template <typename KHT, typename F>
+    void Select(KHT *result, F keep, int threads = 1) const {
+        std::vector<std::vector<kmer_t>> partialResults(threads);
+        long chunkCount = (kh_end(kMers) + INTERSECTION_CHUNK_SIZE - 1) / INTERSECTION_CHUNK_SIZE;
+        ParallelFor(threads, chunkCount, [&](long chunk, int threadID) {
+            auto end = std::min(kh_end(kMers), (khint_t)((chunk + 1) * INTERSECTION_CHUNK_SIZE));
+            for (auto i = (khint_t)(chunk * INTERSECTION_CHUNK_SIZE); i < end; ++i) {
+                if (kh_exist(kMers, i) && keep(Bitmap(i))) partialResults[threadID].push_back(kh_key(kMers, i));
+            }
+        });
+        size_t resultSize = kh_size(result);
+        for (auto &&partialResult : partialResults) resultSize += partialResult.size();
+        reserveKMers(result, resultSize);
+        for (auto &&partialResult : partialResults) {
+            for (auto &&kMer : partialResult) insertCanonicalKMer(result, kMer);
+            std::vector<kmer_t>().swap(partialResult);
+        }
+    }
+
+    /// Group the k-mers by their bitmap, which is their color class, and insert each class into a k-mer set of its own.
+    /// The classes are numbered in the order of their bitmaps, which are stored to colors.
+    /// The classes are counted in the first pass over the buckets, so that their sets are allocated at once.
+    /// In the second one, the threads split the buckets and collect the k-mers of each class separately,
+    /// and then each class is inserted from the collected k-mers, largest classes first.
+    template <typename KHT>
+    std::vector<KHT*> SplitByColor(std::vector<std::vector<uint64_t>> &colors, int threads = 1) const {
+        long chunkCount = (kh_end(kMers) + INTERSECTION_CHUNK_SIZE - 1) / INTERSECTION_CHUNK_SIZE;
+        std::vector<ColorMap> partialCounts(threads, NewColorMap());
+        ParallelFor(threads, chunkCount, [&](long chunk, int threadID) {
+            auto end = std::min(kh_end(kMers), (khint_t)((chunk + 1) * INTERSECTION_CHUNK_SIZE));
+            for (auto i = (khint_t)(chunk * INTERSECTION_CHUNK_SIZE); i < end; ++i) {
+                if (kh_exist(kMers, i)) ++partialCounts[threadID][Bitmap(i)];
+            }
+        });
+        ColorMap counts = NewColorMap();
+        for (auto &&partialCount : partialCounts) {
+            for (auto &&color : partialCount) counts[color.first] += color.second;
+            ColorMap().swap(partialCount);
+        }
+        colors.clear();
+        for (auto &&color : counts) colors.emplace_back(color.first, color.first + words);
+        std::sort(colors.begin(), colors.end());
+        ColorMap colorIDs = NewColorMap();
+        std::vector<KHT*> classes(colors.size());
+        std::vector<size_t> classSizes(colors.size());
+        for (size_t c = 0; c < colors.size(); ++c) {
+            colorIDs[colors[c].data()] = c;
+            classSizes[c] = counts.at(colors[c].data());
+            classes[c] = KMerTable<KHT>::Init();
+            reserveKMers(classes[c], classSizes[c]);
+        }
+        ColorMap().swap(counts);
+        std::vector<std::vector<std::vector<kmer_t>>> partialClasses(threads, std::vector<std::vector<kmer_t>>(colors.size()));
+        ParallelFor(threads, chunkCount, [&](long chunk, int threadID) {
+            auto end = std::min(kh_end(kMers), (khint_t)((chunk + 1) * INTERSECTION_CHUNK_SIZE));
+            for (auto i = (khint_t)(chunk * INTERSECTION_CHUNK_SIZE); i < end; ++i) {
+                if (kh_exist(kMers, i)) partialClasses[threadID][colorIDs.at(Bitmap(i))].push_back(kh_key(kMers, i));
+            }
+        });
+        std::vector<size_t> order(colors.size());
+        for (size_t c = 0; c < order.size(); ++c) order[c] = c;
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return classSizes[a] > classSizes[b]; });
+        ParallelFor(threads, order.size(), [&](long j, int _) {
+            size_t c = order[j];
+            for (auto &&partialClass : partialClasses) {
+                for (auto &&kMer : partialClass[c]) insertCanonicalKMer(classes[c], kMer);
+                std::vector<kmer_t>().swap(partialClass[c]);
+            }
+        });
+        return classes;
+    }
+
+private:
+    /// Hash of the bitmap, which identifies its color class.
+    struct BitmapHash {
+        size_t words;
+        size_t operator()(const uint64_t *bitmap) const {
+            uint64_t hash = 0;
+            for (size_t word = 0; word < words; ++word) hash = MixBits(hash ^ bitmap[word]);
+            return hash;
+        }
+    };
+
+    /// Equality of the bitmaps, that is of their color classes.
+    struct BitmapEqual {
+        size_t words;
+        bool operator()(const uint64_t *a, const uint64_t *b) const {
+            return !memcmp(a, b, words * sizeof(uint64_t));
+        }
+    };
+
+    /// Map from the color classes to numbers, keyed by a bitmap of the class which outlives the map,
+    /// so that the bitmaps of the k-mers are looked up in place.
+    typedef std::unordered_map<const uint64_t*, size_t, BitmapHash, BitmapEqual> ColorMap;
+
+    ColorMap NewColorMap() const {
+        return ColorMap(0, BitmapHash{words}, BitmapEqual{words});
+    }
+
+    /// The bitmap of the k-mer at the given index of the table.
+    const uint64_t *Bitmap(khint_t index) const {
+        return words == 1 ? &kh_val(kMers, index) : &bitmaps[kh_val(kMers, index) * words];
+    }
+
+    size_t setCount;
+    /// Number of 64-bit words of each bitmap.
+    size_t words;
+    typename Table::table_t *kMers;
+    std::vector<uint64_t> bitmaps;
+};
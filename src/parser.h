@@ -4,86 +4,597 @@
 #include <fstream>
 #include <algorithm>
 #include <vector>
+#include <cstring>
+#include <cstdio>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "kmers.h"
 #include "khash_utils.h"
+#include "kthread.h"
+#include "snapshot.h"
+#include "hyperloglog.h"
 
+/// Size of the blocks in which the FASTA files are read.
+constexpr size_t PARSER_BLOCK_SIZE = 1 << 22;
+/// Minimum size of a chunk of a FASTA file parsed by a single thread.
+constexpr size_t PARSER_MIN_CHUNK_SIZE = 1 << 20;
+/// Number of k-mers buffered by each thread for each shard before they are inserted.
+constexpr size_t SHARD_BUFFER_SIZE = 256;
+/// Minimum number of buckets of a range of the k-mer table which is filled by one thread at a time
+/// when the shards are merged; a multiple of the 16 buckets which share their flags in khash.
+constexpr khint_t MERGE_MIN_RANGE_SIZE = 1 << 12;
+/// Relative margin added to the estimated number of distinct k-mers when the tables are sized in advance,
+/// so that an underestimate does not cause a rehash just before the end.
+constexpr double PRESIZE_MARGIN = 0.05;
 
-#define INIT_PARSER(type, variant)                                                                        \
-/*  Read encoded k-mers from the given fasta file.                                                        \
- *  Return unique k-mers in no particular order.                                                          \
- *  If complements is set to true, the result contains only one of the complementary k-mers               \
- *  - it is not guaranteed which one.                                                                     \
- *  This runs in O(sequence length) expected time.                                                        \
- */                                                                                                       \
-void ReadKMers(kh_S##variant##_t *kMers, std::string &path, int k, bool complements) {                    \
-    std::ifstream filestream;                                                                             \
-    std::istream *fasta;                                                                                  \
-    if (path == "-") {                                                                                    \
-        fasta = &std::cin;                                                                                \
-    } else {                                                                                              \
-        filestream.open(path);                                                                            \
-        fasta = &filestream;                                                                              \
-        if (!filestream.is_open()) {                                                                      \
-            std::cerr << "Error: file '" << path << "' could not be open." << std::endl;                  \
-            exit(1);                                                                                      \
-        }                                                                                                 \
-    }                                                                                                     \
-    char c;                                                                                               \
-    int beforeKMerEnd = k;                                                                                \
-    kmer##type##_t currentKMer = 0;                                                                       \
-    kmer##type##_t complement = 0;                                                                        \
-    /* mask that works even for k=32. */                                                                  \
-    kmer##type##_t mask = (((kmer##type##_t) 1) <<  (2 * k - 1));                                         \
-    mask |= mask - 1;                                                                                     \
-    bool readingHeader = false;                                                                           \
-    while ((*fasta) >> std::noskipws >> c) {                                                              \
-        if (c == '>') {                                                                                   \
-            readingHeader = true;                                                                         \
-            currentKMer = 0;                                                                              \
-            beforeKMerEnd = k;                                                                            \
-        }                                                                                                 \
-        else if (c == '\n') readingHeader = false;                                                        \
-        if (readingHeader) continue;                                                                      \
-        auto data = NucleotideToInt(c);                                                                   \
-        /* Disregard white space. */                                                                      \
-        if (c == '\n' || c == '\r' || c == ' ') continue;                                                 \
-        if (data == -1) {                                                                                 \
-            currentKMer = 0;                                                                              \
-            beforeKMerEnd = k;                                                                            \
-            continue;                                                                                     \
-        }                                                                                                 \
-        currentKMer <<= 2;                                                                                \
-        currentKMer &= mask;                                                                              \
-        currentKMer |= data;                                                                              \
-        complement >>= 2;                                                                                 \
-        complement |= ((kmer##type##_t (3)) ^ data) << ((k - 1) << 1);                                    \
-        if(beforeKMerEnd > 0) --beforeKMerEnd;                                                            \
-        if (beforeKMerEnd == 0) {                                                                         \
-            kmer##type##_t canonicalKMer = ((!complements) || currentKMer < complement) ?                 \
-                    currentKMer : complement;                                                             \
-            insertCanonicalKMer(kMers, canonicalKMer);                                                    \
-        }                                                                                                 \
-    }                                                                                                     \
-    if (filestream.is_open()) filestream.close();                                                         \
-}                                                                                                         \
-                                                                                                          \
-                                                                                                          \
-/* Data for parallel reading of k-mers. */                                                                \
-struct ReadKMersData##variant {                                                                           \
-    std::vector<kh_S##variant##_t*> kMers;                                                                \
-    std::vector<std::string> paths;                                                                       \
-    int k;                                                                                                \
-    bool complements;                                                                                     \
-};                                                                                                        \
-                                                                                                          \
-/* Parallel wrapper for ReadKMers. */                                                                     \
-void ReadKMersThread##variant(void *arg, long i, int _) {                                                 \
-    auto *data = (ReadKMersData##variant *) arg;                                                          \
-    ReadKMers(data->kMers[i], data->paths[i], data->k, data->complements);                                \
-}                                                                                                         \
-
-INIT_PARSER(64, 64S)
-INIT_PARSER(64, 64M)
-INIT_PARSER(128, 128M)
-INIT_PARSER(256, 256M)
+/// Codes of the characters in FASTA files used by the parser.
+constexpr int8_t CHAR_WHITESPACE = 4;
+constexpr int8_t CHAR_OTHER = -1;
+
+/// Table converting characters into nucleotide codes, CHAR_WHITESPACE for ignored characters
+/// and CHAR_OTHER for characters that interrupt the sequence.
+struct NucleotideTable {
+    int8_t codes[256];
+    constexpr NucleotideTable() : codes() {
+        for (int i = 0; i < 256; ++i) codes[i] = CHAR_OTHER;
+        codes[(uint8_t)'A'] = codes[(uint8_t)'a'] = 0;
+        codes[(uint8_t)'C'] = codes[(uint8_t)'c'] = 1;
+        codes[(uint8_t)'G'] = codes[(uint8_t)'g'] = 2;
+        codes[(uint8_t)'T'] = codes[(uint8_t)'t'] = 3;
+        codes[(uint8_t)'\n'] = codes[(uint8_t)'\r'] = codes[(uint8_t)' '] = CHAR_WHITESPACE;
+    }
+};
+constexpr NucleotideTable NUCLEOTIDE_TABLE;
+
+/// Number of characters classified at once by the parser.
+constexpr int CHAR_BLOCK_SIZE = 32;
+
+/// Classification of CHAR_BLOCK_SIZE consecutive characters of a FASTA file.
+/// Bit i of bases (whitespace) is set if the i-th character is a nucleotide (ignored white space);
+/// codes[i] is the nucleotide code of the i-th character and is only meaningful if it is a nucleotide.
+struct CharBlock {
+    uint32_t bases;
+    uint32_t whitespace;
+    uint8_t codes[CHAR_BLOCK_SIZE];
+};
+
+typedef void (*CharClassifier)(const char *data, CharBlock &block);
+
+/// Classify the characters using the nucleotide table; this works on any CPU.
+inline void ClassifyCharsScalar(const char *data, CharBlock &block) {
+    block.bases = block.whitespace = 0;
+    for (int i = 0; i < CHAR_BLOCK_SIZE; ++i) {
+        int8_t code = NUCLEOTIDE_TABLE.codes[(uint8_t) data[i]];
+        block.codes[i] = code & 3;
+        block.bases |= uint32_t(code >= 0 && code < 4) << i;
+        block.whitespace |= uint32_t(code == CHAR_WHITESPACE) << i;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/// Classify the characters 32 at a time with AVX2.
+/// The nucleotides are recognized after clearing the lowercase bit; their codes are looked up by the low nibble,
+/// which is 1, 3, 7 and 4 for A, C, G and T respectively.
+__attribute__((target("avx2"))) inline void ClassifyCharsAVX2(const char *data, CharBlock &block) {
+    __m256i chars = _mm256_loadu_si256((const __m256i *) data);
+    __m256i upper = _mm256_and_si256(chars, _mm256_set1_epi8((char) 0xDF));
+    __m256i bases = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(upper, _mm256_set1_epi8('A')), _mm256_cmpeq_epi8(upper, _mm256_set1_epi8('C'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(upper, _mm256_set1_epi8('G')), _mm256_cmpeq_epi8(upper, _mm256_set1_epi8('T'))));
+    __m256i whitespace = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\r'))),
+            _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' ')));
+    const __m256i lookup = _mm256_setr_epi8(0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0,
+                                            0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m256i codes = _mm256_shuffle_epi8(lookup, _mm256_and_si256(chars, _mm256_set1_epi8(0x0F)));
+    _mm256_storeu_si256((__m256i *) block.codes, codes);
+    block.bases = (uint32_t) _mm256_movemask_epi8(bases);
+    block.whitespace = (uint32_t) _mm256_movemask_epi8(whitespace);
+}
+
+/// Classify the characters 16 at a time with SSE4.1, in the same way as ClassifyCharsAVX2.
+__attribute__((target("sse4.1"))) inline void ClassifyCharsSSE41(const char *data, CharBlock &block) {
+    const __m128i lookup = _mm_setr_epi8(0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0);
+    block.bases = block.whitespace = 0;
+    for (int half = 0; half < CHAR_BLOCK_SIZE; half += 16) {
+        __m128i chars = _mm_loadu_si128((const __m128i *) (data + half));
+        __m128i upper = _mm_and_si128(chars, _mm_set1_epi8((char) 0xDF));
+        __m128i bases = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(upper, _mm_set1_epi8('A')), _mm_cmpeq_epi8(upper, _mm_set1_epi8('C'))),
+                _mm_or_si128(_mm_cmpeq_epi8(upper, _mm_set1_epi8('G')), _mm_cmpeq_epi8(upper, _mm_set1_epi8('T'))));
+        __m128i whitespace = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(chars, _mm_set1_epi8('\r'))),
+                _mm_cmpeq_epi8(chars, _mm_set1_epi8(' ')));
+        __m128i codes = _mm_shuffle_epi8(lookup, _mm_and_si128(chars, _mm_set1_epi8(0x0F)));
+        _mm_storeu_si128((__m128i *) (block.codes + half), codes);
+        block.bases |= (uint32_t) _mm_movemask_epi8(bases) << half;
+        block.whitespace |= (uint32_t) _mm_movemask_epi8(whitespace) << half;
+    }
+}
+#endif
+
+/// Select the fastest character classifier supported by the CPU.
+inline CharClassifier SelectCharClassifier() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) return ClassifyCharsAVX2;
+    if (__builtin_cpu_supports("sse4.1")) return ClassifyCharsSSE41;
+#endif
+    return ClassifyCharsScalar;
+}
+
+/// The character classifier used by the parser, selected once at startup.
+inline const CharClassifier CLASSIFY_CHARS = SelectCharClassifier();
+
+/// State of the k-mer parser which is carried over between consecutive blocks of a FASTA file.
+/// K is either int or a ConstantK for the sizes of k specialized at compile time.
+template <typename kmer_t, typename K = int>
+struct KMerParserState {
+    K k;
+    bool complements;
+    kmer_t currentKMer = 0;
+    kmer_t complement = 0;
+    int beforeKMerEnd;
+    bool readingHeader = false;
+
+    KMerParserState(K k, bool complements) : k(k), complements(complements), beforeKMerEnd(k) {}
+
+    /// The mask of the bits of a k-mer; it works even for k=32.
+    inline kmer_t Mask() const {
+        kmer_t mask = ((kmer_t) 1) << (2 * k - 1);
+        return mask | (mask - 1);
+    }
+
+    /// Forget the current k-mer, e.g. at the start of a new record.
+    inline void Reset() {
+        currentKMer = 0;
+        beforeKMerEnd = k;
+    }
+};
+
+/// Parse the block [begin, end) of a FASTA file and call onKMer on each canonical k-mer found.
+/// The state is updated so that the next block can continue where this one ended.
+template <typename kmer_t, typename K, typename F>
+inline void ParseFastaBlock(const char *begin, const char *end, KMerParserState<kmer_t, K> &state, F &&onKMer) {
+    const char *position = begin;
+    const int complementShift = (state.k - 1) << 1;
+    const kmer_t mask = state.Mask();
+    while (position < end) {
+        if (state.readingHeader) {
+            auto lineEnd = (const char *) memchr(position, '\n', end - position);
+            /* The rest of the block is still the header. */
+            if (lineEnd == nullptr) return;
+            state.readingHeader = false;
+            position = lineEnd + 1;
+            continue;
+        }
+        auto header = (const char *) memchr(position, '>', end - position);
+        const char *sequenceEnd = header == nullptr ? end : header;
+        kmer_t currentKMer = state.currentKMer;
+        kmer_t complement = state.complement;
+        int beforeKMerEnd = state.beforeKMerEnd;
+        auto push = [&](int data) {
+            currentKMer <<= 2;
+            currentKMer &= mask;
+            currentKMer |= data;
+            complement >>= 2;
+            complement |= ((kmer_t (3)) ^ data) << complementShift;
+        };
+        auto report = [&]() {
+            onKMer(state.complements ? std::min(currentKMer, complement) : currentKMer);
+        };
+        /* Classify whole blocks of characters at once; most of them are nucleotides only. */
+        CharBlock block;
+        for (; sequenceEnd - position >= CHAR_BLOCK_SIZE; position += CHAR_BLOCK_SIZE) {
+            CLASSIFY_CHARS(position, block);
+            if (block.bases == ~uint32_t(0) && beforeKMerEnd == 0) {
+                for (int i = 0; i < CHAR_BLOCK_SIZE; ++i) {
+                    push(block.codes[i]);
+                    report();
+                }
+                continue;
+            }
+            for (int i = 0; i < CHAR_BLOCK_SIZE; ++i) {
+                if ((block.bases >> i) & 1) {
+                    push(block.codes[i]);
+                    if (beforeKMerEnd > 0) --beforeKMerEnd;
+                    if (beforeKMerEnd == 0) report();
+                } else if (!((block.whitespace >> i) & 1)) {
+                    currentKMer = 0;
+                    beforeKMerEnd = state.k;
+                }
+            }
+        }
+        for (; position < sequenceEnd; ++position) {
+            int data = NUCLEOTIDE_TABLE.codes[(uint8_t) *position];
+            /* Disregard white space. */
+            if (data == CHAR_WHITESPACE) continue;
+            if (data == CHAR_OTHER) {
+                currentKMer = 0;
+                beforeKMerEnd = state.k;
+                continue;
+            }
+            push(data);
+            if (beforeKMerEnd > 0) --beforeKMerEnd;
+            if (beforeKMerEnd == 0) report();
+        }
+        state.currentKMer = currentKMer;
+        state.complement = complement;
+        state.beforeKMerEnd = beforeKMerEnd;
+        if (header != nullptr) {
+            state.readingHeader = true;
+            state.Reset();
+            position = header + 1;
+        }
+    }
+}
+
+/// Open the given FASTA file for reading; '-' stands for the standard input.
+/// Gzipped files are decompressed transparently.
+gzFile OpenFasta(const std::string &path) {
+    gzFile fasta = path == "-" ? gzdopen(dup(fileno(stdin)), "rb") : gzopen(path.c_str(), "rb");
+    if (fasta == nullptr) {
+        std::cerr << "Error: file '" << path << "' could not be open." << std::endl;
+        exit(1);
+    }
+    gzbuffer(fasta, PARSER_BLOCK_SIZE);
+    return fasta;
+}
+
+/// Read the whole (possibly gzipped) FASTA file in large blocks and call onKMer on each canonical k-mer.
+template <typename kmer_t, typename F>
+void ParseFasta(const std::string &path, int k, bool complements, F &&onKMer) {
+    gzFile fasta = OpenFasta(path);
+    std::vector<char> buffer(PARSER_BLOCK_SIZE);
+    int read;
+    WithK<kmer_t>(k, [&](auto k) {
+        KMerParserState<kmer_t, decltype(k)> state(k, complements);
+        while ((read = gzread(fasta, buffer.data(), (unsigned) buffer.size())) > 0) {
+            ParseFastaBlock(buffer.data(), buffer.data() + read, state, onKMer);
+        }
+    });
+    if (read < 0) {
+        int error;
+        std::cerr << "Error: file '" << path << "' could not be read (" << gzerror(fasta, &error) << ")." << std::endl;
+        exit(1);
+    }
+    gzclose(fasta);
+}
+
+/// Determine whether the parser is inside a header just before reading data[position].
+/// Each position in [chunkBegin, position) is scanned; headerBefore tells whether the parser is inside
+/// a header before reading data[chunkBegin].
+inline bool IsInHeader(const char *data, size_t chunkBegin, size_t position, bool headerBefore) {
+    while (position > chunkBegin) {
+        --position;
+        if (data[position] == '\n') return false;
+        if (data[position] == '>') return true;
+    }
+    return headerBefore;
+}
+
+/// Find the position from which the chunk starting at begin has to be parsed so that the k-mers ending
+/// in the chunk are complete. This is the position k-1 non-whitespace characters before the chunk.
+inline size_t ChunkContextStart(const char *data, size_t begin, int k) {
+    int remaining = k - 1;
+    while (begin > 0 && remaining > 0) {
+        --begin;
+        if (NUCLEOTIDE_TABLE.codes[(uint8_t) data[begin]] != CHAR_WHITESPACE) --remaining;
+    }
+    return begin;
+}
+
+/// Parse an uncompressed FASTA file split into chunks on several threads and call onKMer(kMer, threadID)
+/// on each canonical k-mer. Each k-mer is reported exactly once, by the thread parsing the chunk with its last nucleotide.
+/// Return false without parsing anything if the file cannot be split (standard input, gzipped or small files).
+template <typename kmer_t, typename F>
+bool ParseFastaInParallel(const std::string &path, int k, bool complements, int threads, F &&onKMer) {
+    if (path == "-" || threads < 2) return false;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    long chunkCount = std::min((long) threads * 4, (long) (size / PARSER_MIN_CHUNK_SIZE));
+    if (chunkCount < 2) {
+        close(fd);
+        return false;
+    }
+    auto data = (const char *) mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    if ((uint8_t) data[0] == 0x1f && (uint8_t) data[1] == 0x8b) {
+        /* Gzipped files can only be read sequentially. */
+        munmap((void *) data, size);
+        return false;
+    }
+    std::vector<size_t> boundaries(chunkCount + 1);
+    for (long i = 0; i <= chunkCount; ++i) boundaries[i] = size * i / chunkCount;
+
+    /* Determine whether each chunk starts inside a header. */
+    std::vector<int> lastMarks(chunkCount);
+    ParallelFor(threads, chunkCount, [&](long i, int _) {
+        lastMarks[i] = -1;
+        for (size_t position = boundaries[i + 1]; position > boundaries[i]; --position) {
+            char c = data[position - 1];
+            if (c == '\n' || c == '>') {
+                lastMarks[i] = c == '>';
+                break;
+            }
+        }
+    });
+    std::vector<bool> headerBefore(chunkCount, false);
+    for (long i = 1; i < chunkCount; ++i) {
+        headerBefore[i] = lastMarks[i - 1] == -1 ? headerBefore[i - 1] : lastMarks[i - 1];
+    }
+
+    ParallelFor(threads, chunkCount, [&](long i, int threadID) {
+        size_t begin = boundaries[i];
+        size_t contextStart = ChunkContextStart(data, begin, k);
+        long contextChunk = i;
+        while (boundaries[contextChunk] > contextStart) --contextChunk;
+        WithK<kmer_t>(k, [&](auto k) {
+            KMerParserState<kmer_t, decltype(k)> state(k, complements);
+            state.readingHeader = IsInHeader(data, boundaries[contextChunk], contextStart, headerBefore[contextChunk]);
+            /* Read the k-1 nucleotides preceding the chunk without reporting any k-mers. */
+            ParseFastaBlock(data + contextStart, data + begin, state, [](kmer_t _) {});
+            ParseFastaBlock(data + begin, data + boundaries[i + 1], state, [&](kmer_t kMer) { onKMer(kMer, threadID); });
+        });
+    });
+    munmap((void *) data, size);
+    return true;
+}
+
+/// Parse the FASTA file on the given number of threads if it can be split, or sequentially otherwise,
+/// and call onKMer(kMer, threadID) on each canonical k-mer.
+template <typename kmer_t, typename F>
+void ParseFastaWithThreads(const std::string &path, int k, bool complements, int threads, F &&onKMer) {
+    if (ParseFastaInParallel<kmer_t>(path, k, complements, threads, onKMer)) return;
+    ParseFasta<kmer_t>(path, k, complements, [&onKMer](kmer_t kMer) { onKMer(kMer, 0); });
+}
+
+/// Return the size of the file; files of unknown size, such as the standard input, are larger than any other.
+size_t FileSize(const std::string &path) {
+    struct stat st;
+    return (path != "-" && stat(path.c_str(), &st) == 0) ? st.st_size : std::numeric_limits<size_t>::max();
+}
+
+/// Return the index of the smallest of the given files.
+size_t SmallestFile(const std::vector<std::string> &paths) {
+    size_t smallest = 0, smallestSize = std::numeric_limits<size_t>::max();
+    for (size_t i = 0; i < paths.size(); ++i) {
+        size_t size = FileSize(paths[i]);
+        if (i == 0 || size < smallestSize) {
+            smallest = i;
+            smallestSize = size;
+        }
+    }
+    return smallest;
+}
+
+/// Select the shard of the given k-mer.
+template <typename kmer_t>
+inline size_t KMerShard(kmer_t kMer, size_t shardCount) {
+    return (size_t) ((((uint64_t) kMer) * 0x9E3779B97F4A7C15ULL) >> 32) % shardCount;
+}
+
+
+/// Estimate the number of distinct canonical k-mers in the given fasta file with a HyperLogLog sketch.
+/// This takes an extra pass over the file; the number is exact for snapshots and 0 for the standard input,
+/// which cannot be read twice.
+template <typename kmer_t>
+size_t EstimateDistinctKMers(const std::string &path, int k, bool complements, int threads) {
+    SnapshotHeader header;
+    if (ReadSnapshotHeader(path, header)) return header.size;
+    if (path == "-") return 0;
+    std::vector<HyperLogLog> sketches(threads);
+    ParseFastaWithThreads<kmer_t>(path, k, complements, threads, [&](kmer_t kMer, int threadID) {
+        sketches[threadID].Add(MixKMer(kMer));
+    });
+    for (int i = 1; i < threads; ++i) sketches[0].Merge(sketches[i]);
+    return (size_t) (sketches[0].Estimate() * (1 + PRESIZE_MARGIN));
+}
+
+/// Merge the disjoint k-mer sets into kMers, which is large enough for all of them, and destroy them.
+/// The buckets of kMers are split into ranges, each of which is filled by one thread at a time; the threads move
+/// the k-mers of the shards to per-range buffers, which are inserted under the lock of the range once they are full.
+/// The few k-mers whose probe sequences leave their range are inserted afterwards on a single thread.
+template <typename KHT>
+void mergeShards(KHT *kMers, std::vector<KHT*> &shards, int threads) {
+    typedef KMerOf<KHT> kmer_t;
+    typedef KMerTable<KHT> Table;
+    khint_t rangeCount = 1;
+    while (rangeCount < 16 * (khint_t)threads && kh_end(kMers) / (2 * rangeCount) >= MERGE_MIN_RANGE_SIZE) rangeCount *= 2;
+    if (threads == 1 || rangeCount == 1) {
+        for (auto &&shard : shards) {
+            for (auto i = kh_begin(shard); i != kh_end(shard); ++i) {
+                if (isKMerAt(shard, i)) insertCanonicalKMerWithAbundance(kMers, kh_key(shard, i), abundanceAt(shard, i));
+            }
+            mergeRehashes(kMers, shard);
+            Table::Destroy(shard);
+            shard = nullptr;
+        }
+        return;
+    }
+    khint_t rangeSize = kh_end(kMers) / rangeCount, mask = kh_end(kMers) - 1;
+    std::vector<std::mutex> locks(rangeCount);
+    std::vector<std::vector<std::vector<std::pair<kmer_t, byte>>>> buffers(threads,
+            std::vector<std::vector<std::pair<kmer_t, byte>>>(rangeCount));
+    std::vector<std::vector<std::pair<kmer_t, byte>>> overflows(threads);
+    std::vector<khint_t> inserted(threads);
+    auto flush = [&](std::vector<std::pair<kmer_t, byte>> &buffer, khint_t range, int threadID) {
+        std::lock_guard<std::mutex> lock(locks[range]);
+        khint_t hashes[INTERSECTION_BATCH_SIZE];
+        for (size_t batch = 0; batch < buffer.size(); batch += INTERSECTION_BATCH_SIZE) {
+            size_t batchSize = std::min(INTERSECTION_BATCH_SIZE, buffer.size() - batch);
+            for (size_t b = 0; b < batchSize; ++b) {
+                hashes[b] = Table::Hash(buffer[batch + b].first);
+                Table::Prefetch(kMers, hashes[b]);
+            }
+            for (size_t b = 0; b < batchSize; ++b) {
+                auto &kMer = buffer[batch + b];
+                int ret;
+                khint_t index = Table::PutInRange(kMers, kMer.first, hashes[b], range * rangeSize, (range + 1) * rangeSize, &ret);
+                if (index == kh_end(kMers)) {
+                    overflows[threadID].push_back(kMer);
+                    continue;
+                }
+                inserted[threadID] += ret;
+                if constexpr (TableHasValues<KHT>::value) {
+                    int value = ret == 0 ? kh_val(kMers, index) : 0;
+                    kh_val(kMers, index) = (byte)std::min(255, value + kMer.second);
+                }
+            }
+        }
+        buffer.clear();
+    };
+    ParallelFor(threads, shards.size(), [&](long s, int threadID) {
+        KHT *shard = shards[s];
+        for (auto i = kh_begin(shard); i != kh_end(shard); ++i) {
+            if (!isKMerAt(shard, i)) continue;
+            khint_t range = (Table::Hash(kh_key(shard, i)) & mask) / rangeSize;
+            auto &buffer = buffers[threadID][range];
+            buffer.emplace_back(kh_key(shard, i), abundanceAt(shard, i));
+            if (buffer.size() >= SHARD_BUFFER_SIZE) flush(buffer, range, threadID);
+        }
+        mergeRehashes(kMers, shard);
+        Table::Destroy(shard);
+        shards[s] = nullptr;
+    });
+    ParallelFor(threads, rangeCount, [&](long range, int threadID) {
+        for (auto &&threadBuffers : buffers) flush(threadBuffers[range], range, threadID);
+    });
+    khint_t insertedCount = 0;
+    for (auto &&count : inserted) insertedCount += count;
+    Table::AddInserted(kMers, insertedCount);
+    for (auto &&overflow : overflows) {
+        for (auto &&kMer : overflow) insertCanonicalKMerWithAbundance(kMers, kMer.first, kMer.second);
+    }
+}
+
+/// Read encoded k-mers from a single fasta file on several threads.
+/// The threads insert k-mers into shards selected by the k-mer, which are then merged into kMers in parallel.
+/// If the number of distinct k-mers is expected, the shards are sized for their share of it in advance.
+/// Return false if the file cannot be read in parallel; nothing is read in that case.
+template <typename KHT>
+bool ReadKMersInParallel(KHT *kMers, std::string &path, int k, bool complements, int threads, size_t expectedCount = 0) {
+    typedef KMerOf<KHT> kmer_t;
+    size_t shardCount = 4 * threads;
+    std::vector<KHT*> shards(shardCount);
+    std::vector<std::mutex> locks(shardCount);
+    for (auto &&shard : shards) {
+        shard = KMerTable<KHT>::Init();
+        if (expectedCount) reserveKMers(shard, expectedCount / shardCount);
+    }
+    std::vector<std::vector<std::vector<kmer_t>>> buffers(threads, std::vector<std::vector<kmer_t>>(shardCount));
+    auto flush = [&](std::vector<kmer_t> &buffer, size_t shard) {
+        std::lock_guard<std::mutex> lock(locks[shard]);
+        for (auto &&kMer : buffer) insertCanonicalKMer(shards[shard], kMer);
+        buffer.clear();
+    };
+    bool parsed = ParseFastaInParallel<kmer_t>(path, k, complements, threads, [&](kmer_t kMer, int threadID) {
+        size_t shard = KMerShard(kMer, shardCount);
+        auto &buffer = buffers[threadID][shard];
+        buffer.push_back(kMer);
+        if (buffer.size() >= SHARD_BUFFER_SIZE) flush(buffer, shard);
+    });
+    if (parsed) {
+        ParallelFor(threads, shardCount, [&](long shard, int _) {
+            for (auto &&threadBuffers : buffers) flush(threadBuffers[shard], shard);
+        });
+        /* Merge the shards; they are disjoint, so the table can be resized just once. */
+        size_t total = kh_size(kMers);
+        for (auto &&shard : shards) total += kh_size(shard);
+        reserveKMers(kMers, total);
+        mergeShards(kMers, shards, threads);
+    }
+    for (auto &&shard : shards) if (shard != nullptr) KMerTable<KHT>::Destroy(shard);
+    return parsed;
+}
+
+/// Read encoded k-mers from the given fasta file or k-mer set snapshot.
+/// Return unique k-mers in no particular order; their occurrences are counted if kMers stores abundances.
+/// If complements is set to true, the result contains only one of the complementary k-mers
+/// - it is not guaranteed which one.
+/// If presize is set, the number of distinct k-mers is estimated first, so that the table is resized only once.
+/// This runs in O(sequence length) expected time.
+template <typename KHT>
+void ReadKMers(KHT *kMers, std::string &path, int k, bool complements, int threads = 1, bool presize = false) {
+    typedef KMerOf<KHT> kmer_t;
+    if (IsSnapshot(path)) {
+        LoadSnapshot(kMers, path, k, complements, threads);
+        return;
+    }
+    size_t expectedCount = presize ? EstimateDistinctKMers<kmer_t>(path, k, complements, threads) : 0;
+    /* Single large files are split among the threads; otherwise they are read sequentially. */
+    if (threads > 1 && ReadKMersInParallel(kMers, path, k, complements, threads, expectedCount)) return;
+    if (expectedCount) reserveKMers(kMers, kh_size(kMers) + expectedCount);
+    ParseFasta<kmer_t>(path, k, complements, [kMers](kmer_t kMer) {
+        insertCanonicalKMer(kMers, kMer);
+    });
+}
+
+/// Remove the k-mers which do not appear at least minimumAbundance times in the given fasta file from kMers.
+/// The file is streamed, so that only kMers and a counter for each of its buckets are kept in memory.
+/// Snapshots are mapped into memory and queried in place.
+template <typename KHT>
+void IntersectWithFasta(KHT *kMers, std::string &path, int k, bool complements, byte minimumAbundance, int threads) {
+    typedef KMerOf<KHT> kmer_t;
+    if (IsSnapshot(path)) {
+        MappedSnapshot snapshot = MapSnapshot(path, k, complements, sizeof(kmer_t));
+        auto view = SnapshotView<typename SnapshotTableOf<kmer_t>::type>(snapshot);
+        for (auto i = kh_begin(kMers); i != kh_end(kMers); ++i) {
+            if (!isKMerAt(kMers, i)) continue;
+            khint_t found = findCanonicalKMer(&view, kh_key(kMers, i));
+            if (found == kh_end(&view) || snapshot.vals[found] < minimumAbundance) KMerTable<KHT>::Del(kMers, i);
+        }
+        UnmapSnapshot(snapshot);
+        return;
+    }
+    std::vector<std::atomic<byte>> counts(kh_end(kMers));
+    ParseFastaWithThreads<kmer_t>(path, k, complements, threads, [&](kmer_t kMer, int _) {
+        khint_t key = findCanonicalKMer(kMers, kMer);
+        if (key == kh_end(kMers)) return;
+        byte seen = counts[key].load(std::memory_order_relaxed);
+        while (seen < minimumAbundance &&
+               !counts[key].compare_exchange_weak(seen, seen + 1, std::memory_order_relaxed)) {}
+    });
+    for (auto i = kh_begin(kMers); i != kh_end(kMers); ++i) {
+        if (isKMerAt(kMers, i) && counts[i].load() < minimumAbundance) KMerTable<KHT>::Del(kMers, i);
+    }
+}
+
+/// Data for parallel reading of k-mers.
+template <typename KHT>
+struct ReadKMersData {
+    std::vector<KHT*> kMers;
+    std::vector<std::string> paths;
+    int k;
+    bool complements;
+    /// K-mers appearing fewer times are removed once a file is read.
+    byte minimumAbundance;
+    /// Number of threads reading each of the files.
+    int threadsPerSet;
+    /// Whether to estimate the number of k-mers of each file first and size its table in advance.
+    bool presize;
+};
+
+/// Parallel wrapper for ReadKMers.
+template <typename KHT>
+void ReadKMersThread(void *arg, long i, int _) {
+    auto *data = (ReadKMersData<KHT> *) arg;
+    ReadKMers(data->kMers[i], data->paths[i], data->k, data->complements, data->threadsPerSet, data->presize);
+    removeRareKMers(data->kMers[i], data->minimumAbundance);
+}
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <fstream>
+#include <deque>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "kmers.h"
+#include "khash_utils.h"
+#include "parser.h"
+#include "snapshot.h"
+
+/// Length of the minimizers used to partition k-mers.
+constexpr int MINIMIZER_LENGTH = 15;
+/// Maximum number of partitions, so that the partition files of a set can be open at once.
+constexpr size_t MAX_PARTITIONS = 512;
+/// Number of k-mers buffered by each thread for each partition before they are written.
+constexpr size_t PARTITION_BUFFER_SIZE = 64;
+
+/// Compute the hash of the minimizer of the k-mer, that is the minimum hash of its m-mers.
+/// If complements are set, canonical m-mers are used, so that a k-mer and its reverse complement have the same minimizer.
+template <typename kmer_t>
+inline uint64_t MinimizerHash(kmer_t kMer, int k, bool complements) {
+    int m = std::min(k, MINIMIZER_LENGTH);
+    kmer64_t mask = MaskForK64(m);
+    uint64_t minimizer = uint64_t(-1);
+    /* The reverse complement of the m-mer ending i nucleotides before the end of the k-mer
+       starts i nucleotides after the start of the reverse complement of the k-mer. */
+    kmer_t reverse = complements ? ReverseComplement(kMer, k) : kmer_t(0);
+    for (int i = 0; i + m <= k; ++i) {
+        kmer64_t mMer = ((kmer64_t)(kMer >> (i << 1))) & mask;
+        if (complements) mMer = std::min(mMer, ((kmer64_t)(reverse >> ((k - m - i) << 1))) & mask);
+        minimizer = std::min(minimizer, MixBits(mMer));
+    }
+    return minimizer;
+}
+
+/// Select the partition of the canonical k-mer.
+/// Consecutive k-mers mostly share the minimizer and thus end up in the same partition.
+template <typename kmer_t>
+inline size_t KMerPartition(kmer_t kMer, int k, bool complements, size_t partitionCount) {
+    return MinimizerHash(kMer, k, complements) % partitionCount;
+}
+
+/// Estimate the number of k-mers in the given files from their sizes; gzipped files are expected to be compressed 4 times.
+/// The number of k-mers in snapshots is known exactly.
+size_t EstimateKMerCount(const std::vector<std::string> &paths) {
+    size_t count = 0;
+    for (auto &&path : paths) {
+        SnapshotHeader header;
+        if (ReadSnapshotHeader(path, header)) {
+            count += header.size;
+            continue;
+        }
+        struct stat st;
+        if (path == "-" || stat(path.c_str(), &st) != 0) continue;
+        bool gzipped = path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0;
+        count += gzipped ? 4 * st.st_size : st.st_size;
+    }
+    return count;
+}
+
+/// Estimate the memory taken by the k-mer tables of the given files in bytes.
+double TableMemory(const std::vector<std::string> &paths, int k, byte minimumAbundance) {
+    double bytesPerKMer = (k <= 32 ? 8 : (k <= 64 ? 16 : 32)) + (minimumAbundance == (byte)1 ? 0 : 1);
+    /* Flags take a quarter of a byte, the buckets are at most 77% full, and a table can be twice larger than needed. */
+    return EstimateKMerCount(paths) * (bytesPerKMer + 0.25) / __ac_HASH_UPPER * 2;
+}
+
+/// Estimate the number of partitions needed to process the k-mer sets in the given amount of memory.
+/// Without the intersection, the sets are loaded one after another as memory is released, so a single partition
+/// suffices if the largest set fits. Otherwise, a partition of all the sets is in memory at once.
+size_t PartitionCount(const std::vector<std::string> &inPaths, int k, byte minimumAbundance, size_t maxMemory,
+        bool computeIntersection) {
+    if (!computeIntersection) {
+        double largest = 0;
+        for (auto &&path : inPaths) largest = std::max(largest, TableMemory({path}, k, minimumAbundance));
+        if (largest <= maxMemory) return 1;
+    }
+    /* The intersection and the temporary data take at most as much as one more set. */
+    double estimate = TableMemory(inPaths, k, minimumAbundance) * (inPaths.size() + 1) / inPaths.size();
+    return (size_t)std::ceil(estimate / maxMemory);
+}
+
+/// Create a new temporary directory in the given one.
+std::string MakeTemporaryDirectory(const std::string &parent) {
+    std::string pattern = parent + "/prophasm2-XXXXXX";
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+    if (mkdtemp(path.data()) == nullptr) {
+        std::cerr << "Error: temporary directory in '" << parent << "' could not be created." << std::endl;
+        exit(1);
+    }
+    return std::string(path.data());
+}
+
+/// Path of the file with the k-mers of the given set in the given partition.
+std::string PartitionPath(const std::string &directory, size_t set, size_t partition) {
+    return directory + "/" + std::to_string(set) + "_" + std::to_string(partition) + ".bin";
+}
+
+/// Open the file or exit with an error.
+FILE *OpenTemporaryFile(const std::string &path, const char *mode) {
+    FILE *file = fopen(path.c_str(), mode);
+    if (file == nullptr) {
+        std::cerr << "Error: temporary file '" << path << "' could not be open." << std::endl;
+        exit(1);
+    }
+    return file;
+}
+
+/// Split the k-mers of the given fasta file or snapshot into partition files of the given set according to their minimizers.
+/// Each occurrence of a k-mer is written, so that the abundances can be computed when the partition is loaded.
+template <typename kmer_t>
+void PartitionFasta(const std::string &path, const std::string &directory, size_t set, size_t partitionCount,
+                    int k, bool complements, byte minimumAbundance, int threads) {
+    std::vector<FILE*> files(partitionCount);
+    std::vector<std::mutex> locks(partitionCount);
+    for (size_t p = 0; p < partitionCount; ++p) files[p] = OpenTemporaryFile(PartitionPath(directory, set, p), "wb");
+    std::vector<std::vector<std::vector<kmer_t>>> buffers(threads, std::vector<std::vector<kmer_t>>(partitionCount));
+    auto flush = [&](std::vector<kmer_t> &buffer, size_t partition) {
+        std::lock_guard<std::mutex> lock(locks[partition]);
+        if (fwrite(buffer.data(), sizeof(kmer_t), buffer.size(), files[partition]) != buffer.size()) {
+            std::cerr << "Error: k-mers could not be written to a temporary file." << std::endl;
+            exit(1);
+        }
+        buffer.clear();
+    };
+    auto add = [&](kmer_t kMer, int threadID) {
+        size_t partition = KMerPartition(kMer, k, complements, partitionCount);
+        auto &buffer = buffers[threadID][partition];
+        buffer.push_back(kMer);
+        if (buffer.size() >= PARTITION_BUFFER_SIZE) flush(buffer, partition);
+    };
+    if (IsSnapshot(path)) {
+        MappedSnapshot snapshot = MapSnapshot(path, k, complements, sizeof(kmer_t));
+        /* Only whether the minimum abundance is reached matters, so more occurrences are not written. */
+        ForEachSnapshotKMer<kmer_t>(snapshot, [&](kmer_t kMer, byte abundance) {
+            for (int i = 0; i < std::min(abundance, minimumAbundance); ++i) add(kMer, 0);
+        });
+        UnmapSnapshot(snapshot);
+    } else {
+        ParseFastaWithThreads<kmer_t>(path, k, complements, threads, add);
+    }
+    for (auto &&threadBuffers : buffers) {
+        for (size_t p = 0; p < partitionCount; ++p) flush(threadBuffers[p], p);
+    }
+    for (auto &&file : files) fclose(file);
+}
+
+/// Insert the k-mers from the partition file into kMers and remove the file.
+template <typename KHT>
+void LoadPartition(KHT *kMers, const std::string &path) {
+    typedef KMerOf<KHT> kmer_t;
+    FILE *file = OpenTemporaryFile(path, "rb");
+    std::vector<kmer_t> buffer(PARSER_BLOCK_SIZE / sizeof(kmer_t));
+    size_t read;
+    while ((read = fread(buffer.data(), sizeof(kmer_t), buffer.size(), file)) > 0) {
+        for (size_t i = 0; i < read; ++i) insertCanonicalKMer(kMers, buffer[i]);
+    }
+    fclose(file);
+    remove(path.c_str());
+}
+
+/// Encode the given nucleotides.
+template <typename kmer_t>
+inline kmer_t EncodeNucleotides(const char *sequence, int length) {
+    kmer_t encoded = 0;
+    for (int i = 0; i < length; ++i) encoded = (encoded << 2) | kmer_t(NucleotideToInt(sequence[i]));
+    return encoded;
+}
+
+/// Reverse complement the given nucleotides in place.
+inline void ReverseComplementNucleotides(std::string &sequence) {
+    std::reverse(sequence.begin(), sequence.end());
+    for (auto &&c : sequence) c = letters[3 ^ NucleotideToInt(c)];
+}
+
+/// A simplitig fragment in a given orientation.
+struct OrientedFragment {
+    size_t fragment;
+    bool reversed;
+};
+
+/// Join the simplitig fragments which overlap by k-1 nucleotides and write the joined simplitigs to of.
+/// The fragments are read from a FASTA file as written by ComputeSimplitigs; they are typically simplitigs
+/// computed in different partitions, which had to stop at partition boundaries.
+/// Return the number of simplitigs written.
+template <typename kmer_t>
+int GlueSimplitigs(const std::string &fragmentsPath, std::ostream &of, int k, bool complements) {
+    /* Index the fragments. */
+    std::vector<size_t> offsets, lengths;
+    std::vector<kmer_t> prefixes, suffixes;
+    {
+        std::ifstream fragments(fragmentsPath);
+        std::string line;
+        size_t offset = 0;
+        while (std::getline(fragments, line)) {
+            if (!line.empty() && line[0] != '>') {
+                offsets.push_back(offset);
+                lengths.push_back(line.size());
+                prefixes.push_back(EncodeNucleotides<kmer_t>(line.data(), k - 1));
+                suffixes.push_back(EncodeNucleotides<kmer_t>(line.data() + line.size() - (k - 1), k - 1));
+            }
+            offset += line.size() + 1;
+        }
+    }
+    size_t fragmentCount = offsets.size();
+    /* The first and the last (k-1)-mer of a fragment in the given orientation. */
+    auto firstOf = [&](OrientedFragment f) {
+        return f.reversed ? ReverseComplement(suffixes[f.fragment], k - 1) : prefixes[f.fragment];
+    };
+    auto lastOf = [&](OrientedFragment f) {
+        return f.reversed ? ReverseComplement(prefixes[f.fragment], k - 1) : suffixes[f.fragment];
+    };
+    /* Sorted lists of the oriented fragments by their first and last (k-1)-mers. */
+    typedef std::pair<kmer_t, OrientedFragment> Entry;
+    std::vector<Entry> starts, ends;
+    if (k > 1) {
+        for (size_t f = 0; f < fragmentCount; ++f) {
+            for (bool reversed : {false, true}) {
+                if (reversed && !complements) break;
+                starts.push_back({firstOf({f, reversed}), {f, reversed}});
+                ends.push_back({lastOf({f, reversed}), {f, reversed}});
+            }
+        }
+    }
+    auto byKey = [](const Entry &a, const Entry &b) { return a.first < b.first; };
+    std::sort(starts.begin(), starts.end(), byKey);
+    std::sort(ends.begin(), ends.end(), byKey);
+    std::vector<bool> used(fragmentCount, false);
+    /* Find an unused fragment with the given (k-1)-mer in the list. */
+    auto findUnused = [&](std::vector<Entry> &entries, kmer_t key, OrientedFragment &found) {
+        auto range = std::equal_range(entries.begin(), entries.end(), Entry{key, {0, false}}, byKey);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (!used[it->second.fragment]) {
+                found = it->second;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    int fd = open(fragmentsPath.c_str(), O_RDONLY);
+    std::string sequence;
+    auto readFragment = [&](OrientedFragment f) {
+        sequence.resize(lengths[f.fragment]);
+        if (pread(fd, &sequence[0], lengths[f.fragment], offsets[f.fragment]) != (ssize_t)lengths[f.fragment]) {
+            std::cerr << "Error: simplitig fragments could not be read." << std::endl;
+            exit(1);
+        }
+        if (f.reversed) ReverseComplementNucleotides(sequence);
+    };
+    int simplitigID = 0;
+    std::deque<OrientedFragment> chain;
+    for (size_t f = 0; f < fragmentCount; ++f) {
+        if (used[f]) continue;
+        used[f] = true;
+        chain.assign(1, {f, false});
+        OrientedFragment next;
+        while (k > 1 && findUnused(starts, lastOf(chain.back()), next)) {
+            used[next.fragment] = true;
+            chain.push_back(next);
+        }
+        while (k > 1 && findUnused(ends, firstOf(chain.front()), next)) {
+            used[next.fragment] = true;
+            chain.push_front(next);
+        }
+        of << ">" << simplitigID++ << "\n";
+        for (size_t i = 0; i < chain.size(); ++i) {
+            readFragment(chain[i]);
+            size_t skip = i == 0 ? 0 : k - 1;
+            of.write(sequence.data() + skip, sequence.size() - skip);
+        }
+        of << "\n";
+    }
+    close(fd);
+    return simplitigID;
+}
@@ -7,135 +7,360 @@
 #include <cstdint>
 #include <algorithm>
 #include <fstream>
-#include <stack>
+#include <cstring>
+#include <atomic>
+#include <mutex>
 
 #include "kmers.h"
 #include "khash_utils.h"
+#include "kthread.h"
 
+/// Number of buckets of the k-mer set scanned for new simplitigs by one thread at a time.
+constexpr size_t SIMPLITIG_CHUNK_SIZE = 1 << 16;
+/// Size of the per-thread output buffer after which the simplitigs are written.
+constexpr size_t SIMPLITIG_BUFFER_SIZE = 1 << 20;
+/// Initial size of the buffer for building a single simplitig.
+constexpr size_t SIMPLITIG_INITIAL_BUFFER_SIZE = 1 << 12;
 
-/// Find the right extension to the provided last k-mer from the kMers by trying to append each of {A, C, G, T}.
-/// Return the extension - that is the d chars extending the simplitig - and the extending kMer.
-template <typename KHT, typename kmer_t>
-inline uint32_t RightExtension(kmer_t &last, kmer_t &complement, kmer_t &canonical, KHT *kMers, int k, bool complements) {
-    kmer_t k2m1 = (k - 1) << 1;
-    for (kmer_t ext = 0; ext < 4; ++ext) {
-        kmer_t next = (BitSuffix(last, k - 1) << 2) | ext;
-        kmer_t nextComplement = ((ext ^ 3) << k2m1) | (complement >> 2);
-        canonical = ((!complements) || next < nextComplement) ? next : nextComplement;
-        if (containsCanonicalKMer(kMers, canonical)) {
-            last = next;
-            complement = nextComplement;
-            return ext;
+/// Buffer for a simplitig which is built from its initial k-mer and grows in both directions.
+/// It is reused for all the simplitigs computed by a thread, so that no memory is allocated per simplitig once
+/// the buffer is large enough for the longest one.
+class SimplitigBuffer {
+public:
+    /// Start a new simplitig consisting of the given k-mer.
+    template <typename kmer_t>
+    inline void Reset(kmer_t kMer, int k) {
+        if (chars.size() < 2 * (size_t)k) chars.resize(std::max(4 * (size_t)k, SIMPLITIG_INITIAL_BUFFER_SIZE));
+        begin = (chars.size() - k) / 2;
+        end = begin + k;
+        for (int i = k - 1; i >= 0; --i) {
+            chars[begin + i] = letters[(uint32_t)(kMer & kmer_t(3))];
+            kMer >>= 2;
         }
     }
+
+    /// Prepend the character to the simplitig.
+    inline void PushFront(char c) {
+        if (begin == 0) grow();
+        chars[--begin] = c;
+    }
+
+    /// Append the character to the simplitig.
+    inline void PushBack(char c) {
+        if (end == chars.size()) grow();
+        chars[end++] = c;
+    }
+
+    inline const char *Data() const { return chars.data() + begin; }
+    inline size_t Size() const { return end - begin; }
+
+private:
+    std::vector<char> chars;
+    size_t begin = 0, end = 0;
+
+    /// Double the buffer and move the simplitig to its middle.
+    void grow() {
+        std::vector<char> newChars(std::max(2 * chars.size(), SIMPLITIG_INITIAL_BUFFER_SIZE));
+        size_t newBegin = (newChars.size() - Size()) / 2;
+        memcpy(newChars.data() + newBegin, Data(), Size());
+        end = newBegin + Size();
+        begin = newBegin;
+        chars.swap(newChars);
+    }
+};
+
+/// Atomic flags marking the k-mers of a k-mer set which were already used in a simplitig.
+/// The flags are indexed by the bucket of the k-mer.
+struct ClaimedKMers {
+    std::vector<std::atomic<uint64_t>> bits;
+
+    explicit ClaimedKMers(size_t size) : bits((size + 63) / 64) {}
+
+    /// Determine whether the k-mer at the given index was already claimed.
+    inline bool IsClaimed(size_t index) const {
+        return (bits[index >> 6].load(std::memory_order_relaxed) >> (index & 63)) & 1;
+    }
+
+    /// Claim the k-mer at the given index; return false if another thread claimed it first.
+    inline bool Claim(size_t index) {
+        uint64_t bit = uint64_t(1) << (index & 63);
+        return !(bits[index >> 6].fetch_or(bit, std::memory_order_relaxed) & bit);
+    }
+};
+
+/// The four k-mers which can extend a k-mer by one nucleotide, with their complements and the hashes of their
+/// canonical forms. They are computed at once, so that the buckets of all of them are prefetched before the lookups.
+template <typename kmer_t>
+struct Neighbors {
+    kmer_t next[4];
+    kmer_t nextComplement[4];
+    kmer_t canonical[4];
+    khint_t hash[4];
+};
+
+/// Compute the k-mers which append each of {A, C, G, T} to the last k-mer and prefetch their buckets in kMers.
+template <typename KHT, typename kmer_t>
+inline void RightNeighbors(Neighbors<kmer_t> &neighbors, kmer_t last, kmer_t complement, KHT *kMers, int k, bool complements) {
+    int k2m1 = (k - 1) << 1;
+    kmer_t suffix = BitSuffix(last, k - 1) << 2;
+    kmer_t complementSuffix = complement >> 2;
+    for (int ext = 0; ext < 4; ++ext) {
+        neighbors.next[ext] = suffix | kmer_t(ext);
+        neighbors.nextComplement[ext] = (kmer_t(ext ^ 3) << k2m1) | complementSuffix;
+        neighbors.canonical[ext] = ((!complements) || neighbors.next[ext] < neighbors.nextComplement[ext])
+                ? neighbors.next[ext] : neighbors.nextComplement[ext];
+        neighbors.hash[ext] = hashCanonicalKMer(kMers, neighbors.canonical[ext]);
+        prefetchBucket(kMers, neighbors.hash[ext]);
+    }
+}
+
+/// Compute the k-mers which prepend each of {A, C, G, T} to the first k-mer and prefetch their buckets in kMers.
+template <typename KHT, typename kmer_t>
+inline void LeftNeighbors(Neighbors<kmer_t> &neighbors, kmer_t first, kmer_t complement, KHT *kMers, int k, bool complements) {
+    int k2m1 = (k - 1) << 1;
+    kmer_t prefix = first >> 2;
+    kmer_t complementPrefix = BitSuffix(complement, k - 1) << 2;
+    for (int ext = 0; ext < 4; ++ext) {
+        neighbors.next[ext] = (kmer_t(ext) << k2m1) | prefix;
+        neighbors.nextComplement[ext] = complementPrefix | kmer_t(ext ^ 3);
+        neighbors.canonical[ext] = ((!complements) || neighbors.next[ext] < neighbors.nextComplement[ext])
+                ? neighbors.next[ext] : neighbors.nextComplement[ext];
+        neighbors.hash[ext] = hashCanonicalKMer(kMers, neighbors.canonical[ext]);
+        prefetchBucket(kMers, neighbors.hash[ext]);
+    }
+}
+
+/// Find the first of the neighbors present in kMers, probing each of them at most once.
+/// Return the extension and set index to the bucket of the extending k-mer; return -1 if there is none.
+template <typename KHT, typename kmer_t>
+inline uint32_t FindNeighbor(Neighbors<kmer_t> &neighbors, KHT *kMers, khint_t &index) {
+    for (int ext = 0; ext < 4; ++ext) {
+        index = findCanonicalKMerWithHash(kMers, neighbors.canonical[ext], neighbors.hash[ext]);
+        if (index != kh_end(kMers)) return ext;
+    }
     return -1;
 }
 
-/// Find the left extension to the provided first k-mer from the kMers by trying to prepend each of {A, C, G, T}.
-/// Return the extension - that is the d chars extending the simplitig - and the extending kMer.
+/// Find the first of the neighbors present in kMers which can be claimed, probing each of them at most once.
+/// Return the extension and claim the extending k-mer; return -1 if there is none.
 template <typename KHT, typename kmer_t>
-inline uint32_t LeftExtension(kmer_t &first, kmer_t &complement, kmer_t &canonical, KHT *kMers, int k,  bool complements) {
-    kmer_t k2m1 = (k - 1) << 1;
-    for (kmer_t ext = 0; ext < 4; ++ext) {
-        kmer_t next = (ext << k2m1) | (first >> 2);
-        kmer_t nextComplement = (BitSuffix(complement, k - 1) << 2) | (ext ^ 3);
-        canonical = ((!complements) || next < nextComplement) ? next : nextComplement;
-        if (complements) canonical = std::min(next, nextComplement);
-        if (containsCanonicalKMer(kMers, canonical)) {
-            first = next;
-            complement = nextComplement;
-            return ext;
-        }
+inline uint32_t ClaimNeighbor(Neighbors<kmer_t> &neighbors, KHT *kMers, ClaimedKMers &claimed) {
+    for (int ext = 0; ext < 4; ++ext) {
+        khint_t index = findCanonicalKMerWithHash(kMers, neighbors.canonical[ext], neighbors.hash[ext]);
+        if (index != kh_end(kMers) && claimed.Claim(index)) return ext;
     }
     return -1;
 }
 
-/// Find the next simplitig.
+/// Find the right extension to the provided last k-mer from the kMers by trying to append each of {A, C, G, T}.
+/// Return the extension - that is the d chars extending the simplitig - and the index of the extending kMer.
+template <typename KHT, typename kmer_t>
+inline uint32_t RightExtension(kmer_t &last, kmer_t &complement, khint_t &index, KHT *kMers, int k, bool complements) {
+    Neighbors<kmer_t> neighbors;
+    RightNeighbors(neighbors, last, complement, kMers, k, complements);
+    uint32_t ext = FindNeighbor(neighbors, kMers, index);
+    if (ext != uint32_t(-1)) {
+        last = neighbors.next[ext];
+        complement = neighbors.nextComplement[ext];
+    }
+    return ext;
+}
+
+/// Find the left extension to the provided first k-mer from the kMers by trying to prepend each of {A, C, G, T}.
+/// Return the extension - that is the d chars extending the simplitig - and the index of the extending kMer.
+template <typename KHT, typename kmer_t>
+inline uint32_t LeftExtension(kmer_t &first, kmer_t &complement, khint_t &index, KHT *kMers, int k,  bool complements) {
+    Neighbors<kmer_t> neighbors;
+    LeftNeighbors(neighbors, first, complement, kMers, k, complements);
+    uint32_t ext = FindNeighbor(neighbors, kMers, index);
+    if (ext != uint32_t(-1)) {
+        first = neighbors.next[ext];
+        complement = neighbors.nextComplement[ext];
+    }
+    return ext;
+}
+
+/// Find the right extension to the provided last k-mer which can be claimed in kMers by trying to append each of {A, C, G, T}.
+/// Return the extension - that is the d chars extending the simplitig - and claim the extending kMer.
+template <typename KHT, typename kmer_t>
+inline uint32_t RightExtensionClaimed(kmer_t &last, kmer_t &complement, KHT *kMers, ClaimedKMers &claimed, int k, bool complements) {
+    Neighbors<kmer_t> neighbors;
+    RightNeighbors(neighbors, last, complement, kMers, k, complements);
+    uint32_t ext = ClaimNeighbor(neighbors, kMers, claimed);
+    if (ext != uint32_t(-1)) {
+        last = neighbors.next[ext];
+        complement = neighbors.nextComplement[ext];
+    }
+    return ext;
+}
+
+/// Find the left extension to the provided first k-mer which can be claimed in kMers by trying to prepend each of {A, C, G, T}.
+/// Return the extension - that is the d chars extending the simplitig - and claim the extending kMer.
+template <typename KHT, typename kmer_t>
+inline uint32_t LeftExtensionClaimed(kmer_t &first, kmer_t &complement, KHT *kMers, ClaimedKMers &claimed, int k, bool complements) {
+    Neighbors<kmer_t> neighbors;
+    LeftNeighbors(neighbors, first, complement, kMers, k, complements);
+    uint32_t ext = ClaimNeighbor(neighbors, kMers, claimed);
+    if (ext != uint32_t(-1)) {
+        first = neighbors.next[ext];
+        complement = neighbors.nextComplement[ext];
+    }
+    return ext;
+}
+
+/// Find the simplitig starting from the already claimed canonical k-mer begin and store it in the buffer
+/// followed by a new line. The k-mers of the simplitig are claimed instead of being removed from kMers,
+/// so several threads can compute simplitigs from the same k-mer set at once.
+template <typename KHT, typename kmer_t, typename K>
+void NextSimplitigClaimed(KHT *kMers, ClaimedKMers &claimed, kmer_t begin, SimplitigBuffer &simplitig, K k, bool complements) {
+    kmer_t last = begin, first = begin;
+    kmer_t complement = ReverseComplement(begin, k);
+    simplitig.Reset(begin, k);
+    while (true) {
+        uint32_t ext = LeftExtensionClaimed(first, complement, kMers, claimed, k, complements);
+        if (ext == uint32_t(-1)) break;
+        simplitig.PushFront(letters[ext]);
+    }
+    complement = ReverseComplement(begin, k);
+    while (true) {
+        uint32_t ext = RightExtensionClaimed(last, complement, kMers, claimed, k, complements);
+        if (ext == uint32_t(-1)) break;
+        simplitig.PushBack(letters[ext]);
+    }
+    simplitig.PushBack('\n');
+}
+
+/// Find the next simplitig and write it to of, using the given buffer to build it.
+/// The record is named by the simplitig ID after the given prefix.
 /// Also remove the used k-mers from kMers.
 /// If complements are true, it is expected that kMers only contain one k-mer from a complementary pair.
-template <typename KHT, typename kmer_t>
-void NextSimplitig(KHT *kMers, kmer_t begin, std::ostream& of,  int k, bool complements, int simplitigID) {
+template <typename KHT, typename kmer_t, typename K>
+void NextSimplitig(KHT *kMers, kmer_t begin, std::ostream& of,  K k, bool complements, int simplitigID,
+                   SimplitigBuffer &simplitig, const std::string &namePrefix = "") {
      // Maintain the first and last k-mer in the simplitig.
     kmer_t last = begin, first = begin;
     kmer_t complement = ReverseComplement(begin, k);
-    kmer_t canonical;
-    std::string initialKMer = NumberToKMer(begin, k);
-    std::stack<char> simplitig {};
-    for (int i = k - 1; i >= 0; --i) {
-        simplitig.push(initialKMer[i]);
-    }
+    khint_t index;
+    simplitig.Reset(begin, k);
     eraseKMer(kMers, last, k, complements);
-    bool extendToRight = true;
-    bool extendToLeft = true;
-    while (extendToLeft) {
-        uint32_t ext =  LeftExtension(first, complement,canonical, kMers, k, complements);
-        if (ext == uint32_t(-1)) {
-            // No left extension found.
-            extendToLeft = false;
-        } else {
-            // Extend the simplitig to the left.
-            eraseCanonicalKMer(kMers, canonical);
-            simplitig.push(letters[ext]);
-        }
+    while (true) {
+        uint32_t ext =  LeftExtension(first, complement, index, kMers, k, complements);
+        // No left extension found.
+        if (ext == uint32_t(-1)) break;
+        // Extend the simplitig to the left.
+        eraseKMerAt(kMers, index);
+        simplitig.PushFront(letters[ext]);
     }
     complement = ReverseComplement(begin, k);
-    of << ">" << simplitigID << std::endl;
-    while (!simplitig.empty()) {
-        of << simplitig.top();
-        simplitig.pop();
-    }
-    while (extendToRight) {
-        uint32_t ext = RightExtension(last, complement, canonical, kMers, k, complements);
-        if (ext == uint32_t(-1)) {
-            // No right extension found.
-            extendToRight = false;
-        } else {
-            // Extend the simplitig to the right.
-            eraseCanonicalKMer(kMers, canonical);
-            of << letters[ext];
+    while (true) {
+        uint32_t ext = RightExtension(last, complement, index, kMers, k, complements);
+        // No right extension found.
+        if (ext == uint32_t(-1)) break;
+        // Extend the simplitig to the right.
+        eraseKMerAt(kMers, index);
+        simplitig.PushBack(letters[ext]);
+    }
+    simplitig.PushBack('\n');
+    of << ">" << namePrefix << simplitigID << "\n";
+    of.write(simplitig.Data(), simplitig.Size());
+}
+
+
+/// Heuristically compute simplitigs of a single k-mer set on several threads.
+///
+/// Each thread scans a part of the buckets for k-mers not yet used and extends them to both sides.
+/// The k-mers are claimed atomically, so each k-mer ends up in exactly one simplitig.
+/// The order of the simplitigs in the output is not deterministic.
+/// The simplitigs are written in blocks under outputLock if it is given, so that of can be shared with other tasks.
+/// Warning: this will destroy kMers.
+template <typename KHT, typename K>
+int ComputeSimplitigsInParallel(KHT *kMers, std::ostream& of, K k, bool complements, int threads,
+        const std::string &namePrefix = "", std::mutex *outputLock = nullptr) {
+    ClaimedKMers claimed(kh_end(kMers));
+    std::mutex ownOutputLock;
+    int simplitigID = 0;
+    /* Write the simplitigs in the buffer, each on a separate line, and number them. */
+    auto flush = [&](std::string &simplitigs) {
+        std::lock_guard<std::mutex> lock(outputLock != nullptr ? *outputLock : ownOutputLock);
+        size_t begin = 0;
+        while (begin < simplitigs.size()) {
+            size_t end = simplitigs.find('\n', begin) + 1;
+            of << ">" << namePrefix << simplitigID++ << "\n";
+            of.write(simplitigs.data() + begin, end - begin);
+            begin = end;
+        }
+        simplitigs.clear();
+    };
+    long chunkCount = (kh_end(kMers) + SIMPLITIG_CHUNK_SIZE - 1) / SIMPLITIG_CHUNK_SIZE;
+    std::vector<std::string> buffers(threads);
+    std::vector<SimplitigBuffer> simplitigBuffers(threads);
+    ParallelFor(threads, chunkCount, [&](long chunk, int threadID) {
+        std::string &simplitigs = buffers[threadID];
+        khint_t end = std::min(kh_end(kMers), (khint_t)((chunk + 1) * SIMPLITIG_CHUNK_SIZE));
+        for (khint_t i = chunk * SIMPLITIG_CHUNK_SIZE; i < end; ++i) {
+            if (!isKMerAt(kMers, i) || claimed.IsClaimed(i) || !claimed.Claim(i)) continue;
+            SimplitigBuffer &simplitig = simplitigBuffers[threadID];
+            NextSimplitigClaimed(kMers, claimed, kh_key(kMers, i), simplitig, k, complements);
+            simplitigs.append(simplitig.Data(), simplitig.Size());
+            if (simplitigs.size() >= SIMPLITIG_BUFFER_SIZE) flush(simplitigs);
         }
+    });
+    for (auto &&simplitigs : buffers) flush(simplitigs);
+    KMerTable<KHT>::Clear(kMers);
+    return simplitigID;
+}
+
+/// Heuristically compute simplitigs on a single thread.
+/// Warning: this will destroy kMers.
+template <typename KHT, typename K>
+int ComputeSimplitigsSequentially(KHT *kMers, std::ostream& of, K k, bool complements, const std::string &namePrefix = "") {
+    size_t lastIndex = 0;
+    KMerOf<KHT> begin = 0;
+    int simplitigID = 0;
+    SimplitigBuffer simplitig;
+    while(true) {
+        bool found = nextKMer(kMers, lastIndex, begin);
+        // No more k-mers.
+        if (!found) return simplitigID;
+        NextSimplitig(kMers, begin, of,  k, complements, simplitigID++, simplitig, namePrefix);
     }
-    of << std::endl;
 }
 
+/// Heuristically compute simplitigs.
+///
+/// If complements are provided, treat k-mer and its complement as identical.
+/// If this is the case, k-mers are expected not to contain both k-mer and its complement.
+/// The computation is specialized for the common sizes of k.
+/// The records are named by the number of the simplitig after namePrefix. If outputLock is given, of is shared
+/// with other tasks and the simplitigs are written in blocks under the lock, even on a single thread.
+/// Warning: this will destroy kMers.
+template <typename KHT>
+int ComputeSimplitigs(KHT *kMers, std::ostream& of, int k, bool complements, int threads = 1,
+        const std::string &namePrefix = "", std::mutex *outputLock = nullptr) {
+    return WithK<KMerOf<KHT>>(k, [&](auto k) {
+        if (threads > 1 || outputLock != nullptr) {
+            return ComputeSimplitigsInParallel(kMers, of, k, complements, threads, namePrefix, outputLock);
+        }
+        return ComputeSimplitigsSequentially(kMers, of, k, complements, namePrefix);
+    });
+}
 
-#define INIT_PROPHASM(type, variant)                                                                                   \
-                                                                                                                       \
-/*  Heuristically compute simplitigs.                                                                                  \
- *                                                                                                                     \
- *  If complements are provided, treat k-mer and its complement as identical.                                          \
- *  If this is the case, k-mers are expected not to contain both k-mer and its complement.                             \
- *  Warning: this will destroy kMers.                                                                                  \
- */                                                                                                                    \
-int ComputeSimplitigs(kh_S##variant##_t *kMers, std::ostream& of, int k, bool complements) {                           \
-    size_t lastIndex = 0;                                                                                              \
-    kmer##type##_t begin = 0;                                                                                          \
-    int simplitigID = 0;                                                                                               \
-    while(true) {                                                                                                      \
-        bool found = nextKMer(kMers, lastIndex, begin);                                                                \
-        /* No more k-mers. */                                                                                          \
-        if (!found) return simplitigID;                                                                                \
-        NextSimplitig(kMers, begin, of,  k, complements, simplitigID++);                                               \
-    }                                                                                                                  \
-}                                                                                                                      \
-                                                                                                                       \
-/* Data for parallel computation of simplitigs. */                                                                     \
-struct ComputeSimplitigsData##variant {                                                                                \
-    std::vector<kh_S##variant##_t *> kMers;                                                                            \
-    std::vector<std::ostream*> ofs;                                                                                    \
-    int k;                                                                                                             \
-    bool complements;                                                                                                  \
-    std::vector<int> simplitigsCounts;                                                                                 \
-};                                                                                                                     \
-                                                                                                                       \
-/* Parallel wrapper for ComputeSimplitigs. */                                                                          \
-void ComputeSimplitigsThread##variant(void *arg, long i, int _) {                                                      \
-    auto *data = (ComputeSimplitigsData##variant *) arg;                                                               \
-    data->simplitigsCounts[i] = ComputeSimplitigs(data->kMers[i], *data->ofs[i], data->k, data->complements);          \
-}                                                                                                                      \
-
-
-INIT_PROPHASM(64, 64S)
-INIT_PROPHASM(64, 64M)
-INIT_PROPHASM(128, 128M)
-INIT_PROPHASM(256, 256M)
+/// Data for parallel computation of simplitigs.
+template <typename KHT>
+struct ComputeSimplitigsData {
+    std::vector<KHT*> kMers;
+    std::vector<std::ostream*> ofs;
+    int k;
+    bool complements;
+    std::vector<int> simplitigsCounts;
+    /// Number of threads computing simplitigs of each of the sets.
+    int threadsPerSet;
+};
+
+/// Parallel wrapper for ComputeSimplitigs.
+template <typename KHT>
+void ComputeSimplitigsThread(void *arg, long i, int _) {
+    auto *data = (ComputeSimplitigsData<KHT> *) arg;
+    data->simplitigsCounts[i] = ComputeSimplitigs(data->kMers[i], *data->ofs[i], data->k, data->complements,
+                                                  data->threadsPerSet);
+}
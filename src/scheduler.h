@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// Priority of a task: the step of its chain first, so that the chains which have started finish first,
+/// and then its size, so that the largest sets, which take the longest, start first.
+typedef std::pair<int, size_t> TaskPriority;
+
+/// A pool of threads which stay alive for the whole computation and run the submitted tasks, highest priority first.
+/// A task can submit the next step of its work as another task, so that each k-mer set flows through its steps
+/// on its own instead of waiting at a barrier for all the other sets after each step.
+/// The tasks are few and long, so a single queue does not limit the scaling; a task spreads its own work
+/// on ThreadsPerTask() threads, which keeps the cores busy once fewer tasks than threads are left.
+/// A task can also reserve an amount of memory, which its chain releases when it frees its data. Such a task
+/// only starts if the reserved memory stays within the budget, or if no memory is reserved at all.
+class TaskPool {
+public:
+    /// Create the pool with the given number of threads and memory budget in bytes; 0 means no budget.
+    explicit TaskPool(int threads, size_t memoryBudget = 0) : threadCount(threads), memoryBudget(memoryBudget) {
+        for (int i = 0; i < threads; ++i) workers.emplace_back([this] { Work(); });
+    }
+
+    TaskPool(const TaskPool &) = delete;
+    TaskPool &operator=(const TaskPool &) = delete;
+
+    ~TaskPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        available.notify_all();
+        for (auto &&worker : workers) worker.join();
+    }
+
+    /// Queue the task, which reserves the given amount of memory when it starts until it is released.
+    /// Tasks of equal priority start in the order of submission.
+    void Submit(TaskPriority priority, std::function<void()> task, size_t memory = 0) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push({priority, submitted++, memory, std::move(task)});
+        }
+        available.notify_one();
+    }
+
+    /// Release memory reserved by a task, which lets the waiting tasks start.
+    void Release(size_t memory) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            memoryReserved -= memory;
+        }
+        available.notify_all();
+    }
+
+    /// Wait until all the submitted tasks, including those submitted by other tasks, have finished.
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return queue.empty() && running == 0; });
+    }
+
+    /// Number of threads the calling task can use for its own work.
+    /// The threads which run no task are split among the running tasks; none are left while tasks are waiting
+    /// for a thread, but tasks waiting for memory do not count.
+    int ThreadsPerTask() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (CanStart()) return 1;
+        return std::max(1, threadCount / std::max(1, running));
+    }
+
+private:
+    struct Task {
+        TaskPriority priority;
+        size_t order;
+        size_t memory;
+        std::function<void()> run;
+
+        bool operator<(const Task &other) const {
+            return priority != other.priority ? priority < other.priority : order > other.order;
+        }
+    };
+
+    /// Determine whether the next task can start; the caller holds the lock.
+    bool CanStart() const {
+        if (queue.empty()) return false;
+        size_t memory = queue.top().memory;
+        return !memoryBudget || !memory || !memoryReserved || memoryReserved + memory <= memoryBudget;
+    }
+
+    void Work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            available.wait(lock, [this] { return (stopping && queue.empty()) || CanStart(); });
+            if (queue.empty()) return;
+            Task task = std::move(const_cast<Task &>(queue.top()));
+            queue.pop();
+            memoryReserved += task.memory;
+            ++running;
+            lock.unlock();
+            task.run();
+            lock.lock();
+            --running;
+            if (queue.empty() && running == 0) finished.notify_all();
+        }
+    }
+
+    int threadCount;
+    size_t memoryBudget;
+    size_t memoryReserved = 0;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable available;
+    std::condition_variable finished;
+    std::priority_queue<Task> queue;
+    size_t submitted = 0;
+    int running = 0;
+    bool stopping = false;
+};
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "khash_utils.h"
+#include "kthread.h"
+
+/// Magic bytes at the beginning of a k-mer set snapshot.
+constexpr char SNAPSHOT_MAGIC[8] = {'P', 'H', '2', 'K', 'S', 'E', 'T', '\0'};
+/// Version of the snapshot layout.
+/// The hash table is stored as is, so it has to change whenever the layout of khash or the hash functions change.
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+/// Alignment of the arrays in the snapshot.
+constexpr size_t SNAPSHOT_ALIGNMENT = 64;
+/// Number of bytes copied by one thread at a time when loading a snapshot.
+constexpr size_t SNAPSHOT_CHUNK_SIZE = 1 << 24;
+
+/// Header of a k-mer set snapshot.
+/// It is followed by the flags, the keys and the abundances of the hash table, each aligned to SNAPSHOT_ALIGNMENT.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t k;
+    uint32_t complements;
+    uint32_t keySize;
+    uint64_t nBuckets;
+    uint64_t size;
+    uint64_t nOccupied;
+    uint64_t upperBound;
+};
+
+/// Round the offset up to the snapshot alignment.
+inline size_t AlignSnapshotOffset(size_t offset) {
+    return (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+/// Offsets of the arrays in a snapshot with the given header.
+struct SnapshotLayout {
+    size_t flags, keys, vals, end;
+
+    explicit SnapshotLayout(const SnapshotHeader &header) {
+        size_t flagsSize = header.nBuckets ? __ac_fsize(header.nBuckets) * sizeof(khint32_t) : 0;
+        flags = AlignSnapshotOffset(sizeof(SnapshotHeader));
+        keys = AlignSnapshotOffset(flags + flagsSize);
+        vals = AlignSnapshotOffset(keys + header.nBuckets * header.keySize);
+        end = vals + header.nBuckets;
+    }
+};
+
+/// A snapshot mapped into memory.
+struct MappedSnapshot {
+    SnapshotHeader header;
+    void *data = nullptr;
+    size_t length = 0;
+    const khint32_t *flags = nullptr;
+    const void *keys = nullptr;
+    const byte *vals = nullptr;
+};
+
+/// Read the header of the given file if it is a k-mer set snapshot; return false otherwise.
+/// The standard input is never considered a snapshot.
+bool ReadSnapshotHeader(const std::string &path, SnapshotHeader &header) {
+    if (path == "-") return false;
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) return false;
+    bool isSnapshot = fread(&header, sizeof(header), 1, file) == 1
+            && memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0;
+    fclose(file);
+    return isSnapshot;
+}
+
+/// Determine whether the given file is a k-mer set snapshot.
+bool IsSnapshot(const std::string &path) {
+    SnapshotHeader header;
+    return ReadSnapshotHeader(path, header);
+}
+
+/// Map the snapshot into memory and check that it was created with the given parameters; exit with an error otherwise.
+MappedSnapshot MapSnapshot(const std::string &path, int k, bool complements, size_t keySize) {
+    MappedSnapshot snapshot;
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        std::cerr << "Error: snapshot '" << path << "' could not be open." << std::endl;
+        exit(1);
+    }
+    snapshot.length = st.st_size;
+    if (snapshot.length < sizeof(SnapshotHeader)
+            || (snapshot.data = mmap(nullptr, snapshot.length, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        std::cerr << "Error: snapshot '" << path << "' could not be read." << std::endl;
+        exit(1);
+    }
+    close(fd);
+    /* The advice values are not flags, so each one is given separately. */
+    madvise(snapshot.data, snapshot.length, MADV_SEQUENTIAL);
+    madvise(snapshot.data, snapshot.length, MADV_WILLNEED);
+    memcpy(&snapshot.header, snapshot.data, sizeof(SnapshotHeader));
+    auto &header = snapshot.header;
+    if (header.version != SNAPSHOT_VERSION) {
+        std::cerr << "Error: snapshot '" << path << "' has version " << header.version << ", but version "
+            << SNAPSHOT_VERSION << " is required; recreate it with 'prophasm2 index'." << std::endl;
+        exit(1);
+    }
+    if (header.k != k || (bool)header.complements != complements || header.keySize != keySize) {
+        std::cerr << "Error: snapshot '" << path << "' was created with k=" << header.k
+            << (header.complements ? " with" : " without") << " reverse complements, which does not match the current parameters."
+            << std::endl;
+        exit(1);
+    }
+    SnapshotLayout layout(header);
+    if (layout.end > snapshot.length) {
+        std::cerr << "Error: snapshot '" << path << "' is truncated." << std::endl;
+        exit(1);
+    }
+    auto data = (const char*)snapshot.data;
+    snapshot.flags = (const khint32_t*)(data + layout.flags);
+    snapshot.keys = data + layout.keys;
+    snapshot.vals = (const byte*)(data + layout.vals);
+    return snapshot;
+}
+
+/// Unmap the snapshot.
+void UnmapSnapshot(MappedSnapshot &snapshot) {
+    munmap(snapshot.data, snapshot.length);
+    snapshot.data = nullptr;
+}
+
+/// Call f(kMer, abundance) for every k-mer in the snapshot.
+template <typename kmer_t, typename F>
+void ForEachSnapshotKMer(const MappedSnapshot &snapshot, F f) {
+    auto keys = (const kmer_t*)snapshot.keys;
+    for (size_t i = 0; i < snapshot.header.nBuckets; ++i) {
+        if (!__ac_iseither(snapshot.flags, i)) f(keys[i], snapshot.vals[i]);
+    }
+}
+
+/// Write the k-mer set with its abundances to a snapshot at the given path.
+/// The hash table is written as is, so that it can be loaded without rehashing.
+template <typename KHT>
+void SaveSnapshot(KHT *kMers, const std::string &path, int k, bool complements) {
+    typedef typename std::remove_pointer<decltype(KHT::keys)>::type kmer_t;
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.k = k;
+    header.complements = complements;
+    header.keySize = sizeof(kmer_t);
+    header.nBuckets = kMers->n_buckets;
+    header.size = kMers->size;
+    header.nOccupied = kMers->n_occupied;
+    header.upperBound = kMers->upper_bound;
+    SnapshotLayout layout(header);
+
+    FILE *file = path == "-" ? stdout : fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Error: snapshot '" << path << "' could not be open." << std::endl;
+        exit(1);
+    }
+    size_t written = 0;
+    bool ok = true;
+    auto write = [&](const void *data, size_t offset, size_t length) {
+        static const char padding[SNAPSHOT_ALIGNMENT] = {};
+        ok = ok && fwrite(padding, 1, offset - written, file) == offset - written;
+        if (length) ok = ok && fwrite(data, 1, length, file) == length;
+        written = offset + length;
+    };
+    write(&header, 0, sizeof(header));
+    if (header.nBuckets) {
+        write(kMers->flags, layout.flags, __ac_fsize(header.nBuckets) * sizeof(khint32_t));
+        write(kMers->keys, layout.keys, header.nBuckets * sizeof(kmer_t));
+        if constexpr (TableHasValues<KHT>::value) {
+            write(kMers->vals, layout.vals, header.nBuckets);
+        } else {
+            /* Sets store every k-mer once. */
+            std::vector<byte> ones(header.nBuckets, 1);
+            write(ones.data(), layout.vals, header.nBuckets);
+        }
+    }
+    write(nullptr, layout.end, 0);
+    if (file != stdout) ok = fclose(file) == 0 && ok;
+    else ok = fflush(file) == 0 && ok;
+    if (!ok) {
+        std::cerr << "Error: snapshot '" << path << "' could not be written." << std::endl;
+        exit(1);
+    }
+}
+
+/// Copy the arrays of the hash table stored in the mapped snapshot into the empty khash table kMers,
+/// on several threads if given.
+template <typename KHT>
+void CopySnapshotTable(KHT *kMers, const MappedSnapshot &snapshot, int threads) {
+    typedef typename std::remove_pointer<decltype(KHT::keys)>::type kmer_t;
+    auto &header = snapshot.header;
+    size_t flagsSize = header.nBuckets ? __ac_fsize(header.nBuckets) * sizeof(khint32_t) : 0;
+    size_t keysSize = header.nBuckets * sizeof(kmer_t);
+    free(kMers->flags);
+    free(kMers->keys);
+    kMers->flags = (khint32_t*)malloc(flagsSize);
+    kMers->keys = (kmer_t*)malloc(keysSize);
+    struct Copy { void *to; const void *from; size_t length; };
+    std::vector<Copy> copies = {{kMers->flags, snapshot.flags, flagsSize}, {kMers->keys, snapshot.keys, keysSize}};
+    if constexpr (TableHasValues<KHT>::value) {
+        free(kMers->vals);
+        kMers->vals = (byte*)malloc(header.nBuckets);
+        copies.push_back({kMers->vals, snapshot.vals, header.nBuckets});
+    }
+    /* Split the copies into chunks, so that the threads share the memory bandwidth. */
+    std::vector<Copy> chunks;
+    for (auto &&copy : copies) {
+        for (size_t offset = 0; offset < copy.length; offset += SNAPSHOT_CHUNK_SIZE) {
+            chunks.push_back({(char*)copy.to + offset, (const char*)copy.from + offset,
+                              std::min(SNAPSHOT_CHUNK_SIZE, copy.length - offset)});
+        }
+    }
+    ParallelFor(threads, chunks.size(), [&](long i, int _) {
+        memcpy(chunks[i].to, chunks[i].from, chunks[i].length);
+    });
+    kMers->n_buckets = header.nBuckets;
+    kMers->size = header.size;
+    kMers->n_occupied = header.nOccupied;
+    kMers->upper_bound = header.upperBound;
+}
+
+/// Load the k-mer set from the snapshot at the given path into kMers.
+/// If kMers is an empty khash table, the arrays of the stored hash table are copied as they are, on several threads
+/// if given; otherwise the stored k-mers are inserted one by one.
+template <typename KHT>
+void LoadSnapshot(KHT *kMers, const std::string &path, int k, bool complements, int threads = 1) {
+    typedef KMerOf<KHT> kmer_t;
+    MappedSnapshot snapshot = MapSnapshot(path, k, complements, sizeof(kmer_t));
+    if constexpr (KMerTable<KHT>::isKhash) {
+        if (kh_size(kMers) == 0) {
+            CopySnapshotTable(kMers, snapshot, threads);
+            UnmapSnapshot(snapshot);
+            return;
+        }
+    }
+    reserveKMers(kMers, kh_size(kMers) + snapshot.header.size);
+    ForEachSnapshotKMer<kmer_t>(snapshot, [kMers](kmer_t kMer, byte abundance) {
+        insertCanonicalKMerWithAbundance(kMers, kMer, abundance);
+    });
+    UnmapSnapshot(snapshot);
+}
+
+/// The khash table type of the snapshots of k-mers stored in kmer_t.
+template <typename kmer_t>
+struct SnapshotTableOf;
+template <> struct SnapshotTableOf<kmer64_t> { typedef kh_S64M_t type; };
+template <> struct SnapshotTableOf<kmer128_t> { typedef kh_S128M_t type; };
+template <> struct SnapshotTableOf<kmer256_t> { typedef kh_S256M_t type; };
+
+/// Create a read-only view of the hash table stored in the mapped snapshot, which can be queried with kh_get.
+/// The view must not be modified or destroyed, and it is valid only while the snapshot is mapped.
+template <typename KHT>
+KHT SnapshotView(const MappedSnapshot &snapshot) {
+    typedef typename std::remove_pointer<decltype(KHT::keys)>::type kmer_t;
+    KHT view;
+    memset(&view, 0, sizeof(view));
+    view.n_buckets = snapshot.header.nBuckets;
+    view.size = snapshot.header.size;
+    view.n_occupied = snapshot.header.nOccupied;
+    view.upper_bound = snapshot.header.upperBound;
+    view.flags = (khint32_t*)snapshot.flags;
+    view.keys = (kmer_t*)snapshot.keys;
+    if constexpr (TableHasValues<KHT>::value) view.vals = (byte*)snapshot.vals;
+    return view;
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "kmers.h"
+#include "khash.h"
+
+/// Number of slots whose control bytes are matched at once when probing a KMerSwissTable.
+constexpr khint_t SWISS_GROUP_WIDTH = 16;
+/// Control byte of a slot which has never held a k-mer since the last rehash.
+constexpr int8_t SWISS_EMPTY = -128;
+/// Control byte of a slot whose k-mer was deleted while a probe sequence may still pass through it.
+constexpr int8_t SWISS_DELETED = -2;
+/// Maximum fraction of the slots which are full or deleted.
+constexpr double SWISS_MAX_LOAD = 0.875;
+
+/// The control bytes of SWISS_GROUP_WIDTH consecutive slots, matched all at once.
+/// Bit i of each returned mask corresponds to the i-th slot of the group.
+struct SwissGroup {
+#if defined(__SSE2__)
+    __m128i ctrl;
+
+    explicit SwissGroup(const int8_t *position) : ctrl(_mm_loadu_si128((const __m128i *) position)) {}
+
+    /// Find the full slots with the given tag.
+    inline uint32_t Match(int8_t tag) const {
+        return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(tag)));
+    }
+
+    /// Find the empty slots.
+    inline uint32_t MatchEmpty() const {
+        return Match(SWISS_EMPTY);
+    }
+
+    /// Find the empty and deleted slots, which are the only ones with control bytes below -1.
+    inline uint32_t MatchEmptyOrDeleted() const {
+        return (uint32_t) _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), ctrl));
+    }
+#else
+    int8_t ctrl[SWISS_GROUP_WIDTH];
+
+    explicit SwissGroup(const int8_t *position) {
+        memcpy(ctrl, position, SWISS_GROUP_WIDTH);
+    }
+
+    inline uint32_t Match(int8_t tag) const {
+        uint32_t mask = 0;
+        for (khint_t i = 0; i < SWISS_GROUP_WIDTH; ++i) mask |= uint32_t(ctrl[i] == tag) << i;
+        return mask;
+    }
+
+    inline uint32_t MatchEmpty() const {
+        return Match(SWISS_EMPTY);
+    }
+
+    inline uint32_t MatchEmptyOrDeleted() const {
+        uint32_t mask = 0;
+        for (khint_t i = 0; i < SWISS_GROUP_WIDTH; ++i) mask |= uint32_t(ctrl[i] < -1) << i;
+        return mask;
+    }
+#endif
+};
+
+/// Open-addressing hash table of k-mers with abundances (if HasValues is set) in the style of Swiss tables.
+/// Each slot has a control byte, which holds 7 bits of the hash of its k-mer, or marks the slot as empty or deleted.
+/// A lookup compares the control bytes of a whole group of slots to the tag of the k-mer at once, so that
+/// the keys are only read for the slots with a matching tag, and it mostly stops at the first group with an empty slot.
+/// The slots are indexed like the buckets of khash, so that kh_begin, kh_end, kh_size, kh_key and kh_val apply.
+/// The indices are stable until the table is rehashed: deletion marks the slot as deleted only if a probe sequence
+/// can pass through it, and empty otherwise.
+template <typename kmer_t, bool HasValues>
+struct KMerSwissTable {
+    khint_t n_buckets = 0;
+    khint_t size = 0;
+    /// Number of k-mers which can be inserted into empty slots before the table has to be rehashed.
+    khint_t growthLeft = 0;
+    /// The control bytes followed by copies of the first SWISS_GROUP_WIDTH of them, so that groups can wrap around.
+    int8_t *ctrl = nullptr;
+    kmer_t *keys = nullptr;
+    uint8_t *vals = nullptr;
+
+    KMerSwissTable() = default;
+    KMerSwissTable(const KMerSwissTable &) = delete;
+    KMerSwissTable &operator=(const KMerSwissTable &) = delete;
+
+    ~KMerSwissTable() {
+        free(ctrl);
+        free(keys);
+        free(vals);
+    }
+
+    /// Compute the hash of the k-mer; the tag of the k-mer is its 7 highest bits.
+    static inline khint_t Hash(kmer_t kMer) {
+        return (khint_t) MixKMer(kMer);
+    }
+
+    static inline int8_t Tag(khint_t hash) {
+        return (int8_t) (hash >> (8 * sizeof(khint_t) - 7));
+    }
+
+    /// Determine whether there is a k-mer at the given index.
+    inline bool Exists(khint_t index) const {
+        return ctrl[index] >= 0;
+    }
+
+    /// Prefetch the first group probed for a k-mer with the given hash.
+    inline void Prefetch(khint_t hash) const {
+        if (!n_buckets) return;
+        khint_t position = hash & (n_buckets - 1);
+        __builtin_prefetch(&ctrl[position]);
+        __builtin_prefetch(&keys[position]);
+    }
+
+    /// Find the index of the k-mer with the given hash; n_buckets if it is not present.
+    inline khint_t Find(kmer_t kMer, khint_t hash) const {
+        if (!n_buckets) return 0;
+        khint_t mask = n_buckets - 1, position = hash & mask, step = 0;
+        int8_t tag = Tag(hash);
+        while (true) {
+            SwissGroup group(ctrl + position);
+            for (uint32_t match = group.Match(tag); match; match &= match - 1) {
+                khint_t index = (position + __builtin_ctz(match)) & mask;
+                if (keys[index] == kMer) return index;
+            }
+            if (group.MatchEmpty()) return n_buckets;
+            step += SWISS_GROUP_WIDTH;
+            position = (position + step) & mask;
+        }
+    }
+
+    /// Find the index of the k-mer; n_buckets if it is not present.
+    inline khint_t Get(kmer_t kMer) const {
+        return Find(kMer, Hash(kMer));
+    }
+
+    /// Count the groups probed to find the k-mer at the given index.
+    inline khint_t ProbeLength(khint_t index) const {
+        khint_t mask = n_buckets - 1, position = Hash(keys[index]) & mask, step = 0;
+        while (((index - position) & mask) >= SWISS_GROUP_WIDTH) {
+            step += SWISS_GROUP_WIDTH;
+            position = (position + step) & mask;
+        }
+        return step / SWISS_GROUP_WIDTH + 1;
+    }
+
+    /// Count the groups probed to find that a k-mer whose probe sequence starts at the given slot is absent.
+    inline khint_t MissProbeLength(khint_t start) const {
+        khint_t mask = n_buckets - 1, position = start, step = 0;
+        while (!SwissGroup(ctrl + position).MatchEmpty() && step < n_buckets) {
+            step += SWISS_GROUP_WIDTH;
+            position = (position + step) & mask;
+        }
+        return step / SWISS_GROUP_WIDTH + 1;
+    }
+
+    /// Count the deleted slots, which lengthen the probe sequences until the next rehash.
+    inline size_t Tombstones() const {
+        return (khint_t) (n_buckets * SWISS_MAX_LOAD) - growthLeft - size;
+    }
+
+    /// Insert the k-mer if it is not present and return its index.
+    /// Set ret to 1 if the k-mer was inserted and to 0 if it was present; the abundance of a new k-mer is not set.
+    inline khint_t Put(kmer_t kMer, int *ret) {
+        khint_t hash = Hash(kMer);
+        khint_t found = Find(kMer, hash);
+        if (found != n_buckets) {
+            *ret = 0;
+            return found;
+        }
+        khint_t index = n_buckets ? FindInsertSlot(hash) : 0;
+        if (!n_buckets || (growthLeft == 0 && ctrl[index] == SWISS_EMPTY)) {
+            /* Rehash in place if at least half of the full or deleted slots are deleted; grow otherwise. */
+            khint_t full = (khint_t) (n_buckets * SWISS_MAX_LOAD) - growthLeft;
+            Rehash(size + 1 > full / 2 ? std::max(n_buckets * 2, SWISS_GROUP_WIDTH) : n_buckets);
+            index = FindInsertSlot(hash);
+        }
+        if (ctrl[index] == SWISS_EMPTY) --growthLeft;
+        SetCtrl(index, Tag(hash));
+        keys[index] = kMer;
+        ++size;
+        *ret = 1;
+        return index;
+    }
+
+    /// Insert the k-mer with the given hash if it is not present, like Put, but only probe the groups within
+    /// the slots [begin, end) and neither rehash nor update the counts, so that several threads can fill
+    /// disjoint slots at once. Return n_buckets without any change if the probe sequence leaves the slots
+    /// or meets a deleted slot.
+    inline khint_t PutInRange(kmer_t kMer, khint_t hash, khint_t begin, khint_t end, int *ret) {
+        khint_t mask = n_buckets - 1, position = hash & mask, step = 0;
+        int8_t tag = Tag(hash);
+        while (begin <= position && position + SWISS_GROUP_WIDTH <= end && step < n_buckets) {
+            SwissGroup group(ctrl + position);
+            for (uint32_t match = group.Match(tag); match; match &= match - 1) {
+                khint_t index = position + __builtin_ctz(match);
+                if (keys[index] == kMer) {
+                    *ret = 0;
+                    return index;
+                }
+            }
+            uint32_t free = group.MatchEmptyOrDeleted();
+            if (free) {
+                khint_t index = position + __builtin_ctz(free);
+                if (ctrl[index] != SWISS_EMPTY) break;
+                SetCtrl(index, tag);
+                keys[index] = kMer;
+                *ret = 1;
+                return index;
+            }
+            step += SWISS_GROUP_WIDTH;
+            position = (position + step) & mask;
+        }
+        return n_buckets;
+    }
+
+    /// Account for the given number of k-mers inserted into empty slots by PutInRange.
+    inline void AddInserted(khint_t count) {
+        size += count;
+        growthLeft -= count;
+    }
+
+    /// Delete the k-mer at the given index.
+    /// The slot becomes empty again unless some window of SWISS_GROUP_WIDTH slots containing it has no empty slot,
+    /// since only then a probe sequence may have passed through it.
+    inline void Del(khint_t index) {
+        khint_t before = (index - SWISS_GROUP_WIDTH) & (n_buckets - 1);
+        uint32_t emptyAfter = SwissGroup(ctrl + index).MatchEmpty();
+        uint32_t emptyBefore = SwissGroup(ctrl + before).MatchEmpty();
+        bool wasNeverFull = emptyBefore && emptyAfter
+                && (khint_t) (__builtin_ctz(emptyAfter) + __builtin_clz(emptyBefore) - 16) < SWISS_GROUP_WIDTH;
+        SetCtrl(index, wasNeverFull ? SWISS_EMPTY : SWISS_DELETED);
+        if (wasNeverFull) ++growthLeft;
+        --size;
+    }
+
+    /// Rehash the table to the given number of slots rounded up to a power of two, unless the k-mers would not fit.
+    /// The deleted slots are discarded.
+    void Resize(khint_t buckets) {
+        khint_t newBuckets = SWISS_GROUP_WIDTH;
+        while (newBuckets < buckets) newBuckets <<= 1;
+        if (size >= (khint_t) (newBuckets * SWISS_MAX_LOAD)) return;
+        Rehash(newBuckets);
+    }
+
+    /// Remove all the k-mers and keep the memory.
+    void Clear() {
+        if (!n_buckets) return;
+        memset(ctrl, SWISS_EMPTY, n_buckets + SWISS_GROUP_WIDTH);
+        size = 0;
+        growthLeft = (khint_t) (n_buckets * SWISS_MAX_LOAD);
+    }
+
+private:
+    inline void SetCtrl(khint_t index, int8_t value) {
+        ctrl[index] = value;
+        if (index < SWISS_GROUP_WIDTH) ctrl[n_buckets + index] = value;
+    }
+
+    /// Find the first empty or deleted slot in the probe sequence of the given hash.
+    inline khint_t FindInsertSlot(khint_t hash) const {
+        khint_t mask = n_buckets - 1, position = hash & mask, step = 0;
+        while (true) {
+            uint32_t free = SwissGroup(ctrl + position).MatchEmptyOrDeleted();
+            if (free) return (position + __builtin_ctz(free)) & mask;
+            step += SWISS_GROUP_WIDTH;
+            position = (position + step) & mask;
+        }
+    }
+
+    /// Move all the k-mers to new arrays with the given number of slots, which is a power of two.
+    void Rehash(khint_t newBuckets) {
+        int8_t *oldCtrl = ctrl;
+        kmer_t *oldKeys = keys;
+        uint8_t *oldVals = vals;
+        khint_t oldBuckets = n_buckets;
+        n_buckets = newBuckets;
+        ctrl = (int8_t *) malloc(n_buckets + SWISS_GROUP_WIDTH);
+        memset(ctrl, SWISS_EMPTY, n_buckets + SWISS_GROUP_WIDTH);
+        keys = (kmer_t *) malloc(sizeof(kmer_t) * n_buckets);
+        if (HasValues) vals = (uint8_t *) malloc(n_buckets);
+        for (khint_t i = 0; i < oldBuckets; ++i) {
+            if (oldCtrl[i] < 0) continue;
+            khint_t hash = Hash(oldKeys[i]);
+            khint_t index = FindInsertSlot(hash);
+            SetCtrl(index, Tag(hash));
+            keys[index] = oldKeys[i];
+            if (HasValues) vals[index] = oldVals[i];
+        }
+        growthLeft = (khint_t) (n_buckets * SWISS_MAX_LOAD) - size;
+        free(oldCtrl);
+        free(oldKeys);
+        free(oldVals);
+    }
+};
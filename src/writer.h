@@ -0,0 +1,136 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/// Size of the output buffer; the output is written only in blocks of this size.
+constexpr size_t OUTPUT_BUFFER_SIZE = 1 << 22;
+
+/// Determine whether the output at the given path should be gzipped, that is whether it has the .gz extension.
+inline bool IsGzipPath(const std::string &path) {
+    return path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0;
+}
+
+/// Stream buffer writing FASTA output in large blocks, gzipped if the path ends with .gz.
+/// If lineWidth is positive, the sequence lines are wrapped at lineWidth characters.
+/// Flushing the stream, e.g. with std::endl, does not write anything; the buffer is written once it is full and on Close.
+class FastaOutputBuffer : public std::streambuf {
+public:
+    FastaOutputBuffer(const std::string &path, int lineWidth = 0) : path(path), lineWidth(lineWidth) {
+        buffer.reserve(OUTPUT_BUFFER_SIZE + OUTPUT_BUFFER_SIZE / 64 + 1);
+        if (IsGzipPath(path)) {
+            gzOutput = gzopen(path.c_str(), "wb");
+            if (gzOutput != nullptr) gzbuffer(gzOutput, OUTPUT_BUFFER_SIZE);
+        } else {
+            fd = path == "-" ? STDOUT_FILENO : open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (gzOutput == nullptr && fd < 0) {
+            std::cerr << "Error: file '" << path << "' could not be open (error " << errno << ", "
+                << strerror(errno) << ")." << std::endl;
+            exit(1);
+        }
+    }
+
+    ~FastaOutputBuffer() override { Close(); }
+
+    /// Write the rest of the buffer and close the file.
+    void Close() {
+        if (closed) return;
+        closed = true;
+        writeBuffer();
+        if (gzOutput != nullptr) {
+            if (gzclose(gzOutput) != Z_OK) fail();
+        } else if (fd != STDOUT_FILENO && close(fd) != 0) {
+            fail();
+        }
+    }
+
+protected:
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        if (lineWidth <= 0) {
+            buffer.insert(buffer.end(), s, s + n);
+        } else {
+            for (std::streamsize i = 0; i < n; ++i) putWrapped(s[i]);
+        }
+        if (buffer.size() >= OUTPUT_BUFFER_SIZE) writeBuffer();
+        return n;
+    }
+
+    int_type overflow(int_type c) override {
+        if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+        char ch = traits_type::to_char_type(c);
+        xsputn(&ch, 1);
+        return c;
+    }
+
+    int sync() override { return 0; }
+
+private:
+    std::string path;
+    int lineWidth;
+    int fd = -1;
+    gzFile gzOutput = nullptr;
+    bool closed = false;
+    std::vector<char> buffer;
+    /* The state of line wrapping. */
+    bool lineStart = true;
+    bool inHeader = false;
+    int column = 0;
+
+    /// Append the character to the buffer and break the sequence line if it reached lineWidth.
+    inline void putWrapped(char c) {
+        if (c == '\n') {
+            lineStart = true;
+            inHeader = false;
+            column = 0;
+        } else {
+            if (lineStart) inHeader = c == '>';
+            lineStart = false;
+            if (!inHeader && column == lineWidth) {
+                buffer.push_back('\n');
+                column = 0;
+            }
+            ++column;
+        }
+        buffer.push_back(c);
+    }
+
+    void writeBuffer() {
+        size_t written = 0;
+        while (written < buffer.size()) {
+            ssize_t result = gzOutput != nullptr
+                    ? gzwrite(gzOutput, buffer.data() + written, buffer.size() - written)
+                    : write(fd, buffer.data() + written, buffer.size() - written);
+            if (result <= 0) fail();
+            written += result;
+        }
+        buffer.clear();
+    }
+
+    void fail() {
+        std::cerr << "Error: file '" << path << "' could not be written." << std::endl;
+        exit(1);
+    }
+};
+
+/// Output stream for FASTA files backed by FastaOutputBuffer.
+class FastaWriter : public std::ostream {
+public:
+    explicit FastaWriter(const std::string &path, int lineWidth = 0) : std::ostream(nullptr), buffer(path, lineWidth) {
+        rdbuf(&buffer);
+    }
+
+    /// Write the rest of the output and close the file.
+    void Close() {
+        buffer.Close();
+    }
+
+private:
+    FastaOutputBuffer buffer;
+};
@@ -0,0 +1,28 @@
+#pragma once
+#include "../src/hyperloglog.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+    TEST(HyperLogLog, Estimate) {
+        for (size_t count : {0, 10, 1000, 100000, 1000000}) {
+            HyperLogLog sketch;
+            // Each item is added twice; duplicates do not count.
+            for (int repeat = 0; repeat < 2; ++repeat) {
+                for (size_t i = 0; i < count; ++i) sketch.Add(MixBits(i));
+            }
+            double gotResult = sketch.Estimate();
+
+            EXPECT_NEAR((double) count, gotResult, 0.03 * count + 0.5);
+        }
+    }
+
+    TEST(HyperLogLog, Merge) {
+        HyperLogLog first, second;
+        for (size_t i = 0; i < 60000; ++i) first.Add(MixBits(i));
+        for (size_t i = 40000; i < 100000; ++i) second.Add(MixBits(i));
+        first.Merge(second);
+
+        EXPECT_NEAR(100000.0, first.Estimate(), 3000.0);
+    }
+}
@@ -1,6 +1,9 @@
 #pragma once
 #include "../src/khash_utils.h"
 
+#include <map>
+#include <set>
+
 #include "gtest/gtest.h"
 
 namespace {
@@ -42,7 +45,7 @@ namespace {
                 {{{0b0101}, {0b0101}}, {0b0101}},
         };
 
-        for (auto t : tests) {
+        for (auto t : tests) for (int threads : {1, 3}) {
             std::vector<kh_S64M_t *> input (t.kMerSets.size());
             for (size_t i = 0; i < t.kMerSets.size(); ++i) {
                 input[i] = kh_init_S64M();
@@ -51,7 +54,7 @@ namespace {
             }
 
             kh_S64M_t * gotResult = kh_init_S64M();
-            getIntersection(gotResult, input);
+            getIntersection(gotResult, input, threads);
             auto gotResultVec = kMersToVec(gotResult);
             sort(t.wantResult.begin(), t.wantResult.end());
             sort(gotResultVec.begin(), gotResultVec.end());
@@ -60,26 +63,56 @@ namespace {
         }
     }
 
+    TEST(KHASH_UTILS, IntersectionOfLargeSets) {
+        // Enough k-mers for several chunks, so that the threads split the smallest set and their results are merged.
+        srand(42);
+        std::vector<std::vector<kmer_t>> kMerSets(3);
+        for (auto &&kMerSet : kMerSets) for (int i = 0; i < 150000; ++i) kMerSet.push_back(rand() & ((1 << 19) - 1));
+        std::vector<std::set<kmer_t>> sortedSets;
+        for (auto &&kMerSet : kMerSets) sortedSets.emplace_back(kMerSet.begin(), kMerSet.end());
+        std::vector<kmer_t> wantResult;
+        for (auto kMer : sortedSets[0]) {
+            if (sortedSets[1].count(kMer) && sortedSets[2].count(kMer)) wantResult.push_back(kMer);
+        }
+
+        for (int threads : {1, 3}) {
+            std::vector<kh_S64S_t *> input(kMerSets.size());
+            for (size_t i = 0; i < kMerSets.size(); ++i) {
+                input[i] = kh_init_S64S();
+                int ret;
+                for (auto &&kMer : kMerSets[i]) kh_put_S64S(input[i], kMer, &ret);
+                ASSERT_LE(2 * INTERSECTION_CHUNK_SIZE, kh_end(input[i]));
+            }
+
+            kh_S64S_t *gotResult = kh_init_S64S();
+            getIntersection(gotResult, input, threads);
+            auto gotResultVec = kMersToVec(gotResult);
+            sort(gotResultVec.begin(), gotResultVec.end());
+
+            EXPECT_EQ(wantResult, gotResultVec);
+            for (auto &&kMers : input) kh_destroy_S64S(kMers);
+            kh_destroy_S64S(gotResult);
+        }
+    }
+
     TEST(KHASH_UTILS, DifferenceInPlace) {
         struct TestCase {
             std::vector<kmer_t> kMers;
             std::vector<kmer_t> toRemove;
-            int k;
-            bool complements;
             std::vector<kmer_t> wantResult;
         };
 
         std::vector<TestCase> tests = {
                 // {TCC, CTA, ACT, CCT}
                 {{0b110101, 0b011100, 0b000111, 0b010111},
-                 {0b110101}, 3, false,
+                 {0b110101},
                  {0b011100, 0b000111, 0b010111}},
                 // {TCC, CTA, CCT}
                 {{0b110101, 0b011100, 0b010111},
-                 {0b110101, 0b000111}, 3, false,
+                 {0b110101, 0b000111},
                  {0b011100, 0b010111},},
                 // {GG}
-                { {0b0101}, {0b0101}, 2, true, {}},
+                { {0b0101}, {0b0101}, {}},
         };
 
         for (auto t : tests) {
@@ -89,7 +122,7 @@ namespace {
             auto intersection = kh_init_S64M();
             for (auto &&kMer : t.toRemove) kh_put_S64M(intersection, kMer, &ret);
 
-            differenceInPlace(input, intersection, t.k, t.complements);
+            differenceInPlace(input, intersection);
 
             std::vector<kmer_t> gotResult = kMersToVec(input);
             sort(t.wantResult.begin(), t.wantResult.end());
@@ -98,6 +131,100 @@ namespace {
         }
     }
 
+    TEST(KHASH_UTILS, SetOperation) {
+        struct TestCase {
+            SetOperation operation;
+            size_t quorum;
+            std::vector<kmer_t> wantResult;
+        };
+        // {{TCC, CTA, ACT, CCT}, {TCC, ACT, CCT}, {TCC, CTA, ACT, TCT}}
+        std::vector<std::vector<kmer_t>> kMerSets = {{0b110101, 0b011100, 0b000111, 0b010111}, {0b110101, 0b000111, 0b010111},
+                {0b110101, 0b011100, 0b000111, 0b110111}};
+        std::vector<TestCase> tests = {
+                {UNION_OPERATION, 0, {0b110101, 0b011100, 0b000111, 0b010111, 0b110111}},
+                {DIFFERENCE_OPERATION, 0, {}},
+                {SYMMETRIC_DIFFERENCE_OPERATION, 0, {0b110101, 0b000111, 0b110111}},
+                {QUORUM_OPERATION, 1, {0b110101, 0b011100, 0b000111, 0b010111, 0b110111}},
+                {QUORUM_OPERATION, 2, {0b110101, 0b011100, 0b000111, 0b010111}},
+                {QUORUM_OPERATION, 3, {0b110101, 0b000111}},
+                {QUORUM_OPERATION, 4, {}},
+        };
+
+        for (auto t : tests) for (int threads : {1, 3}) {
+            std::vector<kh_S64M_t *> input(kMerSets.size());
+            for (size_t i = 0; i < kMerSets.size(); ++i) {
+                input[i] = kh_init_S64M();
+                int ret;
+                for (auto &&kMer : kMerSets[i]) kh_put_S64M(input[i], kMer, &ret);
+            }
+
+            kh_S64M_t *gotResult = kh_init_S64M();
+            getSetOperation(gotResult, input, t.operation, t.quorum, threads);
+            auto gotResultVec = kMersToVec(gotResult);
+            sort(t.wantResult.begin(), t.wantResult.end());
+            sort(gotResultVec.begin(), gotResultVec.end());
+
+            EXPECT_EQ(t.wantResult, gotResultVec);
+            for (auto &&kMers : input) kh_destroy_S64M(kMers);
+            kh_destroy_S64M(gotResult);
+        }
+
+        // The first set minus the others.
+        std::vector<kh_S64M_t *> input = {kh_init_S64M(), kh_init_S64M()};
+        int ret;
+        for (auto &&kMer : kMerSets[0]) kh_put_S64M(input[0], kMer, &ret);
+        for (auto &&kMer : kMerSets[1]) kh_put_S64M(input[1], kMer, &ret);
+        kh_S64M_t *gotResult = kh_init_S64M();
+        getSetOperation(gotResult, input, DIFFERENCE_OPERATION);
+        EXPECT_EQ(std::vector<kmer_t>({0b011100}), kMersToVec(gotResult));
+        for (auto &&kMers : input) kh_destroy_S64M(kMers);
+        kh_destroy_S64M(gotResult);
+    }
+
+    TEST(KHASH_UTILS, SetOperationOnLargeSets) {
+        // Enough k-mers for several chunks of the scanned sets; the results are compared with the counts of the sets.
+        srand(42);
+        std::vector<std::vector<kmer_t>> kMerSets(3);
+        for (auto &&kMerSet : kMerSets) for (int i = 0; i < 150000; ++i) kMerSet.push_back(rand() & ((1 << 19) - 1));
+        std::map<kmer_t, std::vector<bool>> membership;
+        for (size_t i = 0; i < kMerSets.size(); ++i) {
+            for (auto &&kMer : kMerSets[i]) {
+                membership[kMer].resize(kMerSets.size());
+                membership[kMer][i] = true;
+            }
+        }
+
+        for (auto operation : {UNION_OPERATION, DIFFERENCE_OPERATION, SYMMETRIC_DIFFERENCE_OPERATION, QUORUM_OPERATION}) {
+            std::vector<kmer_t> wantResult;
+            for (auto &&kMer : membership) {
+                size_t count = std::count(kMer.second.begin(), kMer.second.end(), true);
+                bool keep = operation == UNION_OPERATION
+                        || (operation == DIFFERENCE_OPERATION && count == 1 && kMer.second[0])
+                        || (operation == SYMMETRIC_DIFFERENCE_OPERATION && count % 2 == 1)
+                        || (operation == QUORUM_OPERATION && count >= 2);
+                if (keep) wantResult.push_back(kMer.first);
+            }
+            for (int threads : {1, 3}) {
+                std::vector<kh_S64S_t *> input(kMerSets.size());
+                for (size_t i = 0; i < kMerSets.size(); ++i) {
+                    input[i] = kh_init_S64S();
+                    int ret;
+                    for (auto &&kMer : kMerSets[i]) kh_put_S64S(input[i], kMer, &ret);
+                    ASSERT_LE(2 * INTERSECTION_CHUNK_SIZE, kh_end(input[i]));
+                }
+
+                kh_S64S_t *gotResult = kh_init_S64S();
+                getSetOperation(gotResult, input, operation, 2, threads);
+                auto gotResultVec = kMersToVec(gotResult);
+                sort(gotResultVec.begin(), gotResultVec.end());
+
+                EXPECT_EQ(wantResult, gotResultVec);
+                for (auto &&kMers : input) kh_destroy_S64S(kMers);
+                kh_destroy_S64S(gotResult);
+            }
+        }
+    }
+
     TEST(KHASH_UTILS, AbundanceIntegration) {
         struct TestCase {
             std::vector<std::pair<byte, kmer_t>> kMers;
@@ -116,20 +243,122 @@ namespace {
         };
 
         for (auto t : tests) {
-            // Turn off optimizations for MINIMUM_ABUNDANCE being 1.
-            MINIMUM_ABUNDANCE = 255;
-            kh_S64M_t * input = kh_init_S64M();
-            for (auto &&[abundance, kMer] : t.kMers) for (byte i = 0; i < abundance; ++i)
-                insertKMer(input, kMer, t.k, t.complements);
-
             for (auto &&[abundance, wantResult] : t.wantResults) {
-                MINIMUM_ABUNDANCE = abundance;
+                kh_S64M_t * input = kh_init_S64M();
+                for (auto &&[count, kMer] : t.kMers) for (byte i = 0; i < count; ++i)
+                    insertKMer(input, kMer, t.k, t.complements);
+
+                removeRareKMers(input, abundance);
                 for (auto &&[_, kMer] : t.kMers) {
                     bool contains = containsKMer(input, kMer, t.k, t.complements);
                     bool should_contain = wantResult.end() != find(wantResult.begin(), wantResult.end(), kMer);
                     EXPECT_EQ(should_contain, contains);
                 }
+                EXPECT_EQ(wantResult.size(), kh_size(input));
+                kh_destroy_S64M(input);
             }
         }
     }
+
+    TEST(KHASH_UTILS, FindCanonicalKMerWithHash) {
+        kh_S64M_t *kMers = kh_init_S64M();
+        int ret;
+        for (kmer_t kMer = 0; kMer < 1000; ++kMer) kh_put_S64M(kMers, kMer * 7, &ret);
+        // Leave deleted buckets in the probe sequences.
+        for (kmer_t kMer = 0; kMer < 1000; kMer += 3) eraseCanonicalKMer(kMers, kMer * 7);
+
+        for (kmer_t kMer = 0; kMer < 7000; ++kMer) {
+            khint_t got = findCanonicalKMerWithHash(kMers, kMer, hashCanonicalKMer(kMers, kMer));
+            EXPECT_EQ(findCanonicalKMer(kMers, kMer), got);
+        }
+    }
+
+    TEST(KHASH_UTILS, WideSets) {
+        int k = 45;
+        kmer128_t kMer = ((kmer128_t)0b1101 << 80) | 0b0110;
+        auto kMers128 = kh_init_S128S();
+        insertKMer(kMers128, kMer, k, true);
+        insertKMer(kMers128, ReverseComplement(kMer, k), k, true);
+        EXPECT_EQ(1, kh_size(kMers128));
+        EXPECT_TRUE(containsKMer(kMers128, ReverseComplement(kMer, k), k, true));
+        EXPECT_EQ(1, abundanceAt(kMers128, findCanonicalKMer(kMers128, CanonicalKMer(kMer, k))));
+        eraseKMer(kMers128, kMer, k, true);
+        EXPECT_EQ(0, kh_size(kMers128));
+        kh_destroy_S128S(kMers128);
+
+        k = 101;
+        auto kMers256 = kh_init_S256S();
+        insertKMer(kMers256, kmer256_t(kMer) << 100, k, true);
+        EXPECT_TRUE(containsKMer(kMers256, ReverseComplement(kmer256_t(kMer) << 100, k), k, true));
+        EXPECT_FALSE(containsKMer(kMers256, kmer256_t(kMer), k, true));
+        kh_destroy_S256S(kMers256);
+    }
+
+    TEST(KHASH_UTILS, ProbeLengthStats) {
+        auto empty = kh_init_S64S();
+        EXPECT_EQ(0, probeLengthStats(empty).lookups);
+        EXPECT_EQ(0, probeLengthStats(empty).Mean());
+        kh_destroy_S64S(empty);
+
+        // Tandem repeats of a short unit with point mutations give highly structured wide k-mers.
+        srand(42);
+        std::string unit = "ACGTTGCA", sequence;
+        for (int i = 0; i < 20000; ++i) {
+            sequence += unit;
+            sequence[sequence.size() - 1 - rand() % unit.size()] = "ACGT"[rand() % 4];
+        }
+        auto kMers128 = kh_init_S128S();
+        auto kMers256 = kh_init_S256S();
+        kmer128_t kMer128 = 0;
+        kmer256_t kMer256 = 0;
+        for (size_t i = 0; i < sequence.size(); ++i) {
+            kMer128 = ((kMer128 << 2) | NucleotideToInt(sequence[i])) & MaskForK128(63);
+            kMer256 = ((kMer256 << 2) | NucleotideToInt(sequence[i])) & MaskForK256(101);
+            if (i >= 62) insertKMer(kMers128, kMer128, 63, true);
+            if (i >= 100) insertKMer(kMers256, kMer256, 101, true);
+        }
+        for (auto stats : {probeLengthStats(kMers128), probeLengthStats(kMers256)}) {
+            EXPECT_LT(10000, stats.lookups);
+            EXPECT_LT(stats.Mean(), 2);
+            EXPECT_LT(stats.max, 64);
+        }
+        EXPECT_EQ(kh_size(kMers128), probeLengthStats(kMers128).lookups);
+        kh_destroy_S128S(kMers128);
+        kh_destroy_S256S(kMers256);
+    }
+
+    TEST(KHASH_UTILS, ProbeLengthHistogram) {
+        ProbeLengthStats stats;
+        for (size_t length : {1, 2, 3, 4, 5, 64, 65, 1000}) stats.Add(length);
+        std::array<size_t, PROBE_HISTOGRAM_BINS> wantHistogram = {1, 1, 2, 1, 0, 0, 1, 2};
+        EXPECT_EQ(wantHistogram, stats.histogram);
+        EXPECT_EQ(8, stats.lookups);
+        EXPECT_EQ(1000, stats.max);
+        EXPECT_EQ(1144 / 8.0, stats.Mean());
+    }
+
+    TEST(KHASH_UTILS, TableDiagnostics) {
+        recordRehashes = true;
+        auto kMers = kh_init_S64S();
+        int ret;
+        for (kmer_t kMer = 0; kMer < 1000; ++kMer) KMerTable<kh_S64S_t>::Put(kMers, kMer, &ret);
+        for (kmer_t kMer = 0; kMer < 100; ++kMer) eraseCanonicalKMer(kMers, kMer);
+
+        auto diagnostics = tableDiagnostics(kMers);
+        EXPECT_EQ(kh_end(kMers), diagnostics.capacity);
+        EXPECT_EQ(900, diagnostics.kMers);
+        EXPECT_EQ(100, diagnostics.tombstones);
+        // The table grows from 4 to 2048 buckets.
+        EXPECT_EQ(10, diagnostics.rehashes.count);
+        EXPECT_EQ(900, diagnostics.hits.lookups);
+        EXPECT_EQ(kh_end(kMers), diagnostics.misses.lookups);
+        EXPECT_LE(diagnostics.hits.Mean(), diagnostics.misses.Mean());
+
+        KMerTable<kh_S64S_t>::Resize(kMers, 4096);
+        EXPECT_EQ(11, rehashesOf(kMers).count);
+        EXPECT_EQ(0, KMerTable<kh_S64S_t>::Tombstones(kMers));
+        KMerTable<kh_S64S_t>::Destroy(kMers);
+        EXPECT_TRUE(rehashLog.records.empty());
+        recordRehashes = false;
+    }
 }
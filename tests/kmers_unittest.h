@@ -150,6 +150,70 @@ namespace {
         }
     }
 
+    TEST(KMers, ReverseComplementRandom) {
+        srand(42);
+        auto randomWord = []() { return ((kmer128_t) rand() << 96) ^ ((kmer128_t) rand() << 64) ^ ((kmer128_t) rand() << 32) ^ rand(); };
+        for (int test = 0; test < 100; ++test) {
+            kmer256_t input(randomWord(), randomWord());
+            for (int k : {1, 31, 32, 33, 63, 64, 65, 101, 128}) {
+                kmer256_t kMer = input & MaskForK256(k);
+                kmer256_t wantResult = 0;
+                for (int i = 0; i < k; ++i) wantResult = (wantResult << 2) | (((kMer >> (2 * i)) & kmer256_t(3)) ^ kmer256_t(3));
+
+                EXPECT_EQ(wantResult, ReverseComplement(kMer, k));
+                if (k <= 64) {
+                    EXPECT_EQ((kmer128_t) wantResult, ReverseComplement((kmer128_t) kMer, k));
+                }
+                if (k <= 32) {
+                    EXPECT_EQ((kmer64_t) wantResult, ReverseComplement((kmer64_t) kMer, k));
+                }
+            }
+        }
+    }
+
+    TEST(KMers, KMerWord256) {
+        srand(42);
+        auto random = []() {
+            kmer256_t w = 0;
+            for (int i = 0; i < 8; ++i) w = (w << 32) | kmer256_t((uint32_t)rand());
+            return w;
+        };
+        auto reverseComplement = [](std::string s) {
+            std::reverse(s.begin(), s.end());
+            for (auto &&c : s) c = letters[3 ^ NucleotideToInt(c)];
+            return s;
+        };
+        for (int i = 0; i < 100; ++i) {
+            kmer256_t a = random(), b = random();
+            for (int shift : {0, 1, 2, 63, 64, 127, 128, 129, 200, 255}) {
+                EXPECT_EQ(a & ((kmer256_t(1) << (256 - shift)) - kmer256_t(1)), (a << shift) >> shift);
+            }
+            EXPECT_EQ(a, (a + b) - b);
+            EXPECT_EQ(NumberToKMer(a, 128) < NumberToKMer(b, 128), a < b);
+            for (int k : {65, 101, 128}) {
+                kmer256_t kMer = a & MaskForK256(k);
+                EXPECT_EQ(reverseComplement(NumberToKMer(kMer, k)), NumberToKMer(ReverseComplement(kMer, k), k));
+            }
+        }
+        EXPECT_EQ(kmer256_t(~(__uint128_t)0, ~(__uint128_t)0), kmer256_t(-1));
+        EXPECT_EQ(3u, (uint32_t)(kmer256_t(0b1011) & kmer256_t(3)));
+    }
+
+    TEST(KMers, WithK) {
+        auto isConstant = [](auto k) { return !std::is_same<decltype(k), int>::value; };
+        EXPECT_TRUE(WithK<kmer64_t>(31, isConstant));
+        EXPECT_FALSE(WithK<kmer64_t>(30, isConstant));
+        EXPECT_FALSE(WithK<kmer128_t>(31, isConstant));
+        EXPECT_TRUE(WithK<kmer128_t>(63, isConstant));
+        EXPECT_FALSE(WithK<kmer256_t>(63, isConstant));
+        for (int k : {15, 21, 30, 31}) {
+            EXPECT_EQ(k, WithK<kmer64_t>(k, [](auto k) { return (int)k; }));
+            EXPECT_EQ(ReverseComplement(kmer64_t(0b100111), k), WithK<kmer64_t>(k, [](auto k) {
+                return ReverseComplement(kmer64_t(0b100111), k);
+            }));
+        }
+    }
+
     TEST(KMers, CanonicalKMer) {
         struct TestCase {
             kmer_t input;
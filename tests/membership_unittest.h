@@ -0,0 +1,115 @@
+#pragma once
+#include "../src/membership.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+    TEST(KMerMembership, AddAndSelect) {
+        // More than 64 sets, so that the bitmaps take two words, and enough k-mers for several chunks;
+        // set i contains the k-mers 2000 * i to 2000 * i + 19999, so that most k-mers are in 10 sets.
+        size_t setCount = 70;
+        KMerMembership<kmer_t> membership(setCount);
+        for (size_t i = 0; i < setCount; ++i) {
+            kh_S64S_t *kMers = kh_init_S64S();
+            int ret;
+            for (kmer_t kMer = 2000 * i; kMer < 2000 * i + 20000; ++kMer) kh_put_S64S(kMers, kMer, &ret);
+            membership.AddSet(i, kMers);
+            kh_destroy_S64S(kMers);
+        }
+        EXPECT_EQ(2000 * (setCount - 1) + 20000, membership.Size());
+        ASSERT_LE(2 * INTERSECTION_CHUNK_SIZE, membership.Size());
+
+        std::vector<kmer_t> wantInSet65, wantInTenSets;
+        for (kmer_t kMer = 0; kMer < membership.Size(); ++kMer) {
+            if (2000 * 65 <= kMer && kMer < 2000 * 65 + 20000) wantInSet65.push_back(kMer);
+            if (kMer >= 2000 * 9 && kMer < 2000 * setCount) wantInTenSets.push_back(kMer);
+        }
+        for (int threads : {1, 3}) {
+            kh_S64S_t *selected = kh_init_S64S();
+            membership.Select(selected, [&](const uint64_t *bitmap) { return membership.Contains(bitmap, 65); }, threads);
+            auto got = kMersToVec(selected);
+            sort(got.begin(), got.end());
+            EXPECT_EQ(wantInSet65, got);
+            kh_destroy_S64S(selected);
+
+            selected = kh_init_S64S();
+            membership.Select(selected, [&](const uint64_t *bitmap) { return membership.Count(bitmap) == 10; }, threads);
+            got = kMersToVec(selected);
+            sort(got.begin(), got.end());
+            EXPECT_EQ(wantInTenSets, got);
+            kh_destroy_S64S(selected);
+        }
+    }
+
+    TEST(KMerMembership, InAllSets) {
+        KMerMembership<kmer_t> membership(2);
+        std::vector<std::vector<kmer_t>> kMerSets = {{1, 2, 3}, {2, 3, 4}};
+        for (size_t i = 0; i < kMerSets.size(); ++i) {
+            kh_S64M_t *kMers = kh_init_S64M();
+            int ret;
+            for (auto &&kMer : kMerSets[i]) kh_put_S64M(kMers, kMer, &ret);
+            membership.AddSet(i, kMers);
+            kh_destroy_S64M(kMers);
+        }
+        kh_S64M_t *intersection = kh_init_S64M();
+        membership.Select(intersection, [&](const uint64_t *bitmap) { return membership.InAllSets(bitmap); });
+        auto got = kMersToVec(intersection);
+        sort(got.begin(), got.end());
+        EXPECT_EQ(std::vector<kmer_t>({2, 3}), got);
+        kh_destroy_S64M(intersection);
+    }
+
+    TEST(KMerMembership, SplitByColor) {
+        // Set i contains the k-mers i to i + 2, so that each k-mer has a color class of its own.
+        for (size_t setCount : {3, 70}) for (int threads : {1, 3}) {
+            KMerMembership<kmer_t> membership(setCount);
+            for (size_t i = 0; i < setCount; ++i) {
+                kh_S64S_t *kMers = kh_init_S64S();
+                int ret;
+                for (kmer_t kMer = i; kMer < i + 3; ++kMer) kh_put_S64S(kMers, kMer, &ret);
+                membership.AddSet(i, kMers);
+                kh_destroy_S64S(kMers);
+            }
+            std::vector<std::vector<uint64_t>> colors;
+            auto classes = membership.SplitByColor<kh_S64S_t>(colors, threads);
+            ASSERT_EQ(setCount + 2, classes.size());
+            ASSERT_EQ(classes.size(), colors.size());
+            EXPECT_TRUE(std::is_sorted(colors.begin(), colors.end()));
+            for (size_t c = 0; c < classes.size(); ++c) {
+                ASSERT_EQ(1, kh_size(classes[c]));
+                kmer_t kMer = kMersToVec(classes[c])[0];
+                for (size_t i = 0; i < setCount; ++i) {
+                    EXPECT_EQ(i <= kMer && kMer < i + 3, KMerMembership<kmer_t>::Contains(colors[c].data(), i));
+                }
+                kh_destroy_S64S(classes[c]);
+            }
+        }
+    }
+
+    TEST(KMerMembership, SplitLargeSetsByColor) {
+        // Enough k-mers for several chunks; the sets contain the k-mers 0 to 99999 and 50000 to 149999.
+        KMerMembership<kmer_t> membership(2);
+        for (kmer_t start : {0, 50000}) {
+            kh_S64S_t *kMers = kh_init_S64S();
+            int ret;
+            for (kmer_t kMer = start; kMer < start + 100000; ++kMer) kh_put_S64S(kMers, kMer, &ret);
+            membership.AddSet(start / 50000, kMers);
+            kh_destroy_S64S(kMers);
+        }
+        ASSERT_LE(2 * INTERSECTION_CHUNK_SIZE, membership.Size());
+        for (int threads : {1, 3}) {
+            std::vector<std::vector<uint64_t>> colors;
+            auto classes = membership.SplitByColor<kh_S64S_t>(colors, threads);
+            ASSERT_EQ(std::vector<std::vector<uint64_t>>({{1}, {2}, {3}}), colors);
+            std::vector<std::pair<kmer_t, kmer_t>> wantRanges = {{0, 50000}, {100000, 150000}, {50000, 100000}};
+            for (size_t c = 0; c < classes.size(); ++c) {
+                auto got = kMersToVec(classes[c]);
+                sort(got.begin(), got.end());
+                std::vector<kmer_t> want;
+                for (kmer_t kMer = wantRanges[c].first; kMer < wantRanges[c].second; ++kMer) want.push_back(kMer);
+                EXPECT_EQ(want, got);
+                kh_destroy_S64S(classes[c]);
+            }
+        }
+    }
+}
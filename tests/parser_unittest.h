@@ -0,0 +1,211 @@
+#pragma once
+#include "../src/parser.h"
+
+#include <map>
+
+#include "gtest/gtest.h"
+
+namespace {
+    TEST(Parser, ParseFastaBlock) {
+        struct TestCase {
+            std::string fasta;
+            int k;
+            bool complements;
+            std::vector<kmer_t> wantResult;
+        };
+        std::vector<TestCase> tests = {
+                // {ACT, CTA}
+                {">1\nACTA\n", 3, false, {0b000111, 0b011100}},
+                // {ACT, CTA}; the k-mer continues over the line break.
+                {">1\nAC\r\nTA\n", 3, false, {0b000111, 0b011100}},
+                // {ACT}; N and the new record interrupt the k-mers.
+                {">1\nACTNTA\n>2 ACG\nCT", 3, false, {0b000111}},
+                // {CAA}, the reverse complement of TTG.
+                {">1\nTTG\n", 3, true, {0b010000}},
+        };
+        // Lines longer than the blocks classified at once; {AAA...A} and {CCC...C} for k=31.
+        std::vector<kmer_t> longLines(10, 0);
+        longLines.resize(50, 0x1555555555555555ULL);
+        tests.push_back({">1\n" + std::string(40, 'A') + "N\n" + std::string(35, 'c') + "\r\n" + std::string(35, 'C') + "\n",
+                         31, true, longLines});
+
+        for (auto &&t: tests) {
+            // Try all possible splits into two blocks.
+            for (size_t split = 0; split <= t.fasta.size(); ++split) {
+                std::vector<kmer_t> gotResult;
+                KMerParserState<kmer_t> state(t.k, t.complements);
+                auto onKMer = [&gotResult](kmer_t kMer) { gotResult.push_back(kMer); };
+                ParseFastaBlock(t.fasta.data(), t.fasta.data() + split, state, onKMer);
+                ParseFastaBlock(t.fasta.data() + split, t.fasta.data() + t.fasta.size(), state, onKMer);
+
+                EXPECT_EQ(t.wantResult, gotResult);
+            }
+        }
+    }
+
+    TEST(Parser, ClassifyChars) {
+        std::vector<CharClassifier> classifiers = {ClassifyCharsScalar, SelectCharClassifier()};
+#if defined(__x86_64__) || defined(__i386__)
+        if (__builtin_cpu_supports("avx2")) classifiers.push_back(ClassifyCharsAVX2);
+        if (__builtin_cpu_supports("sse4.1")) classifiers.push_back(ClassifyCharsSSE41);
+#endif
+        srand(42);
+        for (int test = 0; test < 1000; ++test) {
+            char data[CHAR_BLOCK_SIZE];
+            for (auto &&c : data) c = test % 2 ? "ACGTacgtN\n\r >"[rand() % 13] : (char) (rand() % 256);
+            CharBlock wantResult;
+            wantResult.bases = wantResult.whitespace = 0;
+            for (int i = 0; i < CHAR_BLOCK_SIZE; ++i) {
+                int8_t code = NUCLEOTIDE_TABLE.codes[(uint8_t) data[i]];
+                wantResult.codes[i] = code;
+                if (code >= 0 && code < 4) wantResult.bases |= 1u << i;
+                if (code == CHAR_WHITESPACE) wantResult.whitespace |= 1u << i;
+            }
+            for (auto &&classify : classifiers) {
+                CharBlock gotResult;
+                classify(data, gotResult);
+
+                EXPECT_EQ(wantResult.bases, gotResult.bases);
+                EXPECT_EQ(wantResult.whitespace, gotResult.whitespace);
+                for (int i = 0; i < CHAR_BLOCK_SIZE; ++i) {
+                    if ((wantResult.bases >> i) & 1) {
+                        EXPECT_EQ(wantResult.codes[i], gotResult.codes[i]);
+                    }
+                }
+            }
+        }
+    }
+
+    TEST(Parser, ParseFastaInParallel) {
+        // Random records with short and long lines, long headers and interruptions, spanning several chunks.
+        std::string path = testing::TempDir() + "prophasm_parser_unittest.fa";
+        std::ofstream file(path);
+        srand(42);
+        const char chars[] = "ACGTACGTACGTacgtN";
+        for (int record = 0; record < 300; ++record) {
+            file << ">record " << record << " " << std::string(rand() % 5000, '=') << "\n";
+            int lineLength = record % 3 == 0 ? 100000 : 60;
+            int length = rand() % 30000;
+            for (int i = 0; i < length; ++i) {
+                file << chars[rand() % (record % 10 == 0 ? 17 : 4)];
+                if (i % lineLength == lineLength - 1) file << "\n";
+            }
+            file << "\n";
+        }
+        file.close();
+
+        for (int k : {5, 31}) {
+            std::vector<kmer_t> wantResult, gotResult;
+            ParseFasta<kmer_t>(path, k, true, [&wantResult](kmer_t kMer) { wantResult.push_back(kMer); });
+            std::mutex lock;
+            bool parsed = ParseFastaInParallel<kmer_t>(path, k, true, 7, [&](kmer_t kMer, int _) {
+                std::lock_guard<std::mutex> guard(lock);
+                gotResult.push_back(kMer);
+            });
+            std::sort(wantResult.begin(), wantResult.end());
+            std::sort(gotResult.begin(), gotResult.end());
+
+            EXPECT_TRUE(parsed);
+            EXPECT_EQ(wantResult, gotResult);
+        }
+        std::remove(path.c_str());
+    }
+
+    template <typename KHT>
+    void testMergeShards() {
+        // Enough k-mers for many ranges of the merged table; the k-mer 0 is in it already.
+        srand(42);
+        std::map<kmer_t, int> wantResult = {{0, 1}};
+        std::vector<std::vector<kmer_t>> shardKMers(12);
+        for (int i = 0; i < 200000; ++i) {
+            kmer_t kMer = rand() % 150000;
+            shardKMers[kMer % shardKMers.size()].push_back(kMer);
+            ++wantResult[kMer];
+        }
+        for (int threads : {1, 3}) {
+            KHT *kMers = KMerTable<KHT>::Init();
+            insertCanonicalKMer(kMers, 0);
+            std::vector<KHT*> shards(shardKMers.size());
+            size_t total = kh_size(kMers);
+            for (size_t s = 0; s < shards.size(); ++s) {
+                shards[s] = KMerTable<KHT>::Init();
+                for (auto &&kMer : shardKMers[s]) insertCanonicalKMer(shards[s], kMer);
+                total += kh_size(shards[s]);
+            }
+            reserveKMers(kMers, total);
+            ASSERT_LE(16 * MERGE_MIN_RANGE_SIZE, kh_end(kMers));
+
+            mergeShards(kMers, shards, threads);
+
+            EXPECT_EQ(wantResult.size(), kh_size(kMers));
+            for (auto &&kMer : wantResult) {
+                khint_t index = KMerTable<KHT>::Get(kMers, kMer.first);
+                ASSERT_NE(kh_end(kMers), index);
+                EXPECT_EQ(std::min(255, kMer.second), abundanceAt(kMers, index));
+            }
+            KMerTable<KHT>::Destroy(kMers);
+        }
+    }
+
+    TEST(Parser, MergeShards) {
+        testMergeShards<kh_S64M_t>();
+        testMergeShards<KMerSwissTable<kmer_t, true>>();
+    }
+
+    TEST(Parser, EstimateDistinctKMers) {
+        std::string path = testing::TempDir() + "prophasm_estimate_unittest.fa";
+        std::ofstream file(path);
+        srand(42);
+        for (int record = 0; record < 20; ++record) {
+            file << ">" << record << "\n";
+            for (int i = 0; i < 10000; ++i) file << "ACGT"[rand() % 4];
+            file << "\n";
+        }
+        file.close();
+
+        for (int threads : {1, 3}) {
+            kh_S64S_t *kMers = kh_init_S64S();
+            ReadKMers(kMers, path, 31, true, threads, true);
+            size_t gotResult = EstimateDistinctKMers<kmer_t>(path, 31, true, threads);
+
+            EXPECT_NEAR((double) kh_size(kMers) * (1 + PRESIZE_MARGIN), (double) gotResult, 0.03 * kh_size(kMers));
+            EXPECT_GE(kh_end(kMers), kh_size(kMers) / __ac_HASH_UPPER);
+            kh_destroy_S64S(kMers);
+        }
+        std::remove(path.c_str());
+    }
+
+    TEST(Parser, IntersectWithFasta) {
+        std::string path = testing::TempDir() + "prophasm_intersect_unittest.fa";
+        std::ofstream file(path);
+        // {ACT, CTA, TAC, ACT}
+        file << ">1\nACTAC\n>2\nACT\n";
+        file.close();
+        struct TestCase {
+            byte minimumAbundance;
+            std::vector<kmer_t> wantResult;
+        };
+        std::vector<TestCase> tests = {
+                // {ACT, CTA, TAC}
+                {1, {0b000111, 0b011100, 0b110001}},
+                // {ACT}
+                {2, {0b000111}},
+        };
+
+        for (auto &&t: tests) {
+            auto kMers = kh_init_S64M();
+            // {ACT, CTA, TAC, CCC}, each with abundance 2.
+            for (kmer_t kMer : {0b000111, 0b011100, 0b110001, 0b010101}) {
+                insertCanonicalKMer(kMers, kMer);
+                insertCanonicalKMer(kMers, kMer);
+            }
+
+            IntersectWithFasta(kMers, path, 3, false, t.minimumAbundance, 1);
+            auto gotResult = kMersToVec(kMers);
+            std::sort(gotResult.begin(), gotResult.end());
+
+            EXPECT_EQ(t.wantResult, gotResult);
+        }
+        std::remove(path.c_str());
+    }
+}
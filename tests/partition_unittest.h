@@ -0,0 +1,79 @@
+#pragma once
+#include "../src/partition.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+    TEST(Partition, MinimizerHash) {
+        srand(42);
+        for (int k : {3, 15, 31}) {
+            for (int i = 0; i < 100; ++i) {
+                kmer_t kMer = (((kmer_t) rand() << 32) | rand()) & MaskForK64(k);
+                EXPECT_EQ(MinimizerHash(kMer, k, true), MinimizerHash(ReverseComplement(kMer, k), k, true));
+            }
+        }
+        for (int k : {45, 64}) {
+            for (int i = 0; i < 100; ++i) {
+                kmer128_t kMer = (((kmer128_t) rand() << 96) ^ ((kmer128_t) rand() << 48) ^ rand()) & MaskForK128(k);
+                EXPECT_EQ(MinimizerHash(kMer, k, true), MinimizerHash(ReverseComplement(kMer, k), k, true));
+            }
+        }
+        for (int k : {101, 128}) {
+            for (int i = 0; i < 100; ++i) {
+                kmer256_t kMer = kmer256_t((kmer128_t) rand() << 64 ^ rand(), (kmer128_t) rand() << 70 ^ rand()) & MaskForK256(k);
+                EXPECT_EQ(MinimizerHash(kMer, k, true), MinimizerHash(ReverseComplement(kMer, k), k, true));
+            }
+        }
+    }
+
+    TEST(Partition, GlueSimplitigs) {
+        struct TestCase {
+            std::string fragments;
+            int k;
+            bool complements;
+            std::string wantResult;
+        };
+        std::vector<TestCase> tests = {
+                // ACGT + GTA + TTT
+                {">0\nGTA\n>1\nACGT\n>0\nTTT\n", 3, false, ">0\nACGTA\n>1\nTTT\n"},
+                // ACGG + TCC, the reverse complement of GGA
+                {">0\nACGG\n>0\nTCC\n", 3, true, ">0\nACGGA\n"},
+                // ACGG + TCC is not joined without complements.
+                {">0\nACGG\n>0\nTCC\n", 3, false, ">0\nACGG\n>1\nTCC\n"},
+        };
+
+        for (auto &&t: tests) {
+            std::string path = testing::TempDir() + "prophasm_glue_unittest.fa";
+            std::ofstream file(path);
+            file << t.fragments;
+            file.close();
+            std::stringstream of;
+
+            GlueSimplitigs<kmer_t>(path, of, t.k, t.complements);
+
+            EXPECT_EQ(t.wantResult, of.str());
+            std::remove(path.c_str());
+        }
+    }
+
+    TEST(Partition, PartitionCount) {
+        std::vector<std::string> paths;
+        for (int i = 0; i < 3; ++i) {
+            paths.push_back(testing::TempDir() + "prophasm_partition_count_unittest" + std::to_string(i) + ".fa");
+            std::ofstream file(paths.back());
+            file << ">0\n" << std::string(996, 'A') << "\n";
+        }
+        double setMemory = TableMemory({paths[0]}, 31, 1);
+        ASSERT_DOUBLE_EQ(3 * setMemory, TableMemory(paths, 31, 1));
+
+        // Without the intersection, a single partition suffices if the largest set fits.
+        EXPECT_EQ(1, PartitionCount(paths, 31, 1, setMemory * 1.5, false));
+        EXPECT_EQ(3, PartitionCount(paths, 31, 1, setMemory * 1.5, true));
+        // Otherwise, all the sets are partitioned together and a partition of each is loaded at once.
+        size_t maxMemory = setMemory / 2;
+        EXPECT_EQ(std::ceil(4 * setMemory / maxMemory), PartitionCount(paths, 31, 1, maxMemory, false));
+        EXPECT_EQ(std::ceil(4 * setMemory / maxMemory), PartitionCount(paths, 31, 1, maxMemory, true));
+
+        for (auto &&path : paths) std::remove(path.c_str());
+    }
+}
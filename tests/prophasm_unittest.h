@@ -27,7 +27,7 @@ namespace {
             int ret;
             for (auto &&kMer : t.kMers) kh_put_S64M(kMers, kMer, &ret);
 
-            kmer_t _;
+            khint_t _;
             auto got = RightExtension(t.last, t.complement, _, kMers, t.k, t.complements);
 
             EXPECT_EQ(t.wantNext, t.last);
@@ -59,7 +59,7 @@ namespace {
             int ret;
             for (auto &&kMer : t.kMers) kh_put_S64M(kMers, kMer, &ret);
 
-            kmer_t _;
+            khint_t _;
             auto got = LeftExtension(t.first, t.complement, _, kMers, t.k, t.complements);
             EXPECT_EQ(t.wantNext, t.first);
             EXPECT_EQ(t.wantComplement, t.complement);
@@ -68,6 +68,23 @@ namespace {
     }
 
 
+    TEST(Prophasm, SimplitigBuffer) {
+        SimplitigBuffer simplitig;
+        for (int round = 0; round < 2; ++round) {
+            // ACT
+            simplitig.Reset(kmer_t(0b000111), 3);
+            EXPECT_EQ("ACT", std::string(simplitig.Data(), simplitig.Size()));
+            // Grow the buffer to both sides several times.
+            std::string want = "ACT";
+            for (int i = 0; i < 10000; ++i) {
+                simplitig.PushFront(letters[i % 4]);
+                simplitig.PushBack(letters[(i + 1) % 4]);
+                want = letters[i % 4] + want + letters[(i + 1) % 4];
+            }
+            EXPECT_EQ(want, std::string(simplitig.Data(), simplitig.Size()));
+        }
+    }
+
     TEST(Prophasm, NextSimplitig) {
         struct TestCase {
             std::vector<kmer_t> kMers;
@@ -93,7 +110,8 @@ namespace {
             int ret;
             for (auto &&kMer : t.kMers) kh_put_S64M(kMers, kMer, &ret);
 
-            NextSimplitig(kMers, t.kMers.front(), of, t.k, t.complements, t.simplitigID);
+            SimplitigBuffer simplitig;
+            NextSimplitig(kMers, t.kMers.front(), of, t.k, t.complements, t.simplitigID, simplitig);
             auto remainingKmers = kMersToVec(kMers);
             std::sort(remainingKmers.begin(), remainingKmers.end());
 
@@ -129,4 +147,67 @@ namespace {
             EXPECT_EQ(t.wantResult, of.str());
         }
     }
+
+    TEST(Prophasm, NamePrefix) {
+        // {GCT, TAA, AAA}
+        std::vector<kmer_t> kMers = {0b100111, 0b110000, 0b000000};
+        std::mutex outputLock;
+        for (std::mutex *lock : {(std::mutex *)nullptr, &outputLock}) {
+            std::stringstream of;
+            auto kMerSet = kh_init_S64M();
+            int ret;
+            for (auto &&kMer : kMers) kh_put_S64M(kMerSet, kMer, &ret);
+
+            ComputeSimplitigs(kMerSet, of, 3, false, 1, "7_", lock);
+
+            std::string got = of.str();
+            EXPECT_TRUE(got == ">7_0\nTAAA\n>7_1\nGCT\n" || got == ">7_0\nGCT\n>7_1\nTAAA\n") << got;
+            kh_destroy_S64M(kMerSet);
+        }
+    }
+
+    TEST(Prophasm, ComputeSimplitigsInParallel) {
+        for (bool complements : {false, true}) for (int threads : {2, 4}) {
+            int k = 11;
+            // Random k-mers so that many simplitigs can be extended to both sides, in enough buckets for several chunks,
+            // so that the threads race for the k-mers where their simplitigs meet.
+            srand(42);
+            auto kMers = kh_init_S64M();
+            std::vector<kmer_t> wantKMers;
+            int ret;
+            for (int i = 0; i < 200000; ++i) {
+                kmer_t kMer = rand() & MaskForK64(k);
+                if (complements) kMer = CanonicalKMer(kMer, k);
+                kh_put_S64M(kMers, kMer, &ret);
+                if (ret) wantKMers.push_back(kMer);
+            }
+            ASSERT_LE(4 * SIMPLITIG_CHUNK_SIZE, kh_end(kMers));
+
+            std::stringstream of;
+            int simplitigCount = ComputeSimplitigs(kMers, of, k, complements, threads);
+
+            std::vector<kmer_t> gotKMers;
+            std::string line;
+            int gotSimplitigCount = 0;
+            while (std::getline(of, line)) {
+                if (line[0] == '>') {
+                    EXPECT_EQ(">" + std::to_string(gotSimplitigCount++), line);
+                    continue;
+                }
+                for (size_t i = 0; i + k <= line.size(); ++i) {
+                    kmer_t kMer = 0;
+                    for (int j = 0; j < k; ++j) kMer = (kMer << 2) | NucleotideToInt(line[i + j]);
+                    gotKMers.push_back(complements ? CanonicalKMer(kMer, k) : kMer);
+                }
+            }
+            std::sort(wantKMers.begin(), wantKMers.end());
+            std::sort(gotKMers.begin(), gotKMers.end());
+
+            EXPECT_EQ(simplitigCount, gotSimplitigCount);
+            // Each k-mer appears exactly once.
+            EXPECT_EQ(wantKMers, gotKMers);
+            EXPECT_EQ(0, kh_size(kMers));
+            kh_destroy_S64M(kMers);
+        }
+    }
 }
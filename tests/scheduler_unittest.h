@@ -0,0 +1,98 @@
+#pragma once
+#include "../src/scheduler.h"
+
+#include <atomic>
+
+#include "gtest/gtest.h"
+
+namespace {
+    TEST(TaskPool, Priorities) {
+        TaskPool pool(1);
+        std::vector<int> order;
+        std::mutex lock;
+        lock.lock();
+        // Keep the only thread busy until all the tasks are queued.
+        pool.Submit({2, 0}, [&] { lock.lock(); lock.unlock(); });
+        pool.Submit({0, 10}, [&] { order.push_back(1); });
+        pool.Submit({1, 5}, [&] { order.push_back(2); });
+        pool.Submit({0, 20}, [&] { order.push_back(3); });
+        pool.Submit({0, 10}, [&] { order.push_back(4); });
+        lock.unlock();
+        pool.Wait();
+
+        EXPECT_EQ(std::vector<int>({2, 3, 1, 4}), order);
+    }
+
+    TEST(TaskPool, Chains) {
+        for (int threads : {1, 4}) {
+            TaskPool pool(threads);
+            std::vector<int> steps(100);
+            std::atomic<int> maxThreads(0);
+            for (int i = 0; i < 100; ++i) {
+                pool.Submit({0, (size_t) i}, [&, i] {
+                    ++steps[i];
+                    pool.Submit({1, (size_t) i}, [&, i] {
+                        ++steps[i];
+                        int taskThreads = pool.ThreadsPerTask();
+                        if (taskThreads > maxThreads) maxThreads = taskThreads;
+                    });
+                });
+            }
+            pool.Wait();
+
+            EXPECT_EQ(std::vector<int>(100, 2), steps);
+            EXPECT_LE(1, maxThreads);
+            EXPECT_GE(threads, maxThreads);
+            // A lone task gets all the threads.
+            pool.Submit({0, 0}, [&] { maxThreads = pool.ThreadsPerTask(); });
+            pool.Wait();
+            EXPECT_EQ(threads, maxThreads);
+        }
+    }
+
+    TEST(TaskPool, MemoryBudget) {
+        TaskPool pool(4, 100);
+        std::mutex lock;
+        size_t reserved = 0, maxReserved = 0;
+        for (size_t memory : {60, 50, 40, 30, 150}) {
+            pool.Submit({0, memory}, [&, memory] {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    reserved += memory;
+                    maxReserved = std::max(maxReserved, reserved);
+                }
+                pool.Submit({1, memory}, [&, memory] {
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+                        reserved -= memory;
+                    }
+                    pool.Release(memory);
+                });
+            }, memory);
+        }
+        pool.Wait();
+
+        // The task over the budget runs alone.
+        EXPECT_EQ(150, maxReserved);
+        EXPECT_EQ(0, reserved);
+        maxReserved = 0;
+        for (size_t memory : {60, 50, 40, 30}) {
+            pool.Submit({0, memory}, [&, memory] {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    reserved += memory;
+                    maxReserved = std::max(maxReserved, reserved);
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    reserved -= memory;
+                }
+                pool.Release(memory);
+            }, memory);
+        }
+        pool.Wait();
+
+        EXPECT_GE(100, maxReserved);
+    }
+}
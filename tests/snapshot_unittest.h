@@ -0,0 +1,56 @@
+#pragma once
+#include "../src/snapshot.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+    TEST(Snapshot, SaveAndLoad) {
+        struct TestCase {
+            std::vector<kmer_t> kMers;
+            std::vector<kmer_t> alreadyLoaded;
+        };
+        std::vector<TestCase> tests = {
+                // {}
+                {{}, {}},
+                // {TCC, CTA, ACT, CCT, CTA}
+                {{0b110101, 0b011100, 0b000111, 0b010111, 0b011100}, {}},
+                // {TCC, CTA, ACT, CCT, CTA} loaded into {CTA, AAA}
+                {{0b110101, 0b011100, 0b000111, 0b010111, 0b011100}, {0b011100, 0b000000}},
+        };
+        std::string path = testing::TempDir() + "prophasm_snapshot_unittest.ph2";
+
+        for (auto &&t: tests) {
+            auto kMers = kh_init_S64M();
+            for (auto &&kMer : t.kMers) insertCanonicalKMer(kMers, kMer);
+            SaveSnapshot(kMers, path, 3, true);
+            EXPECT_TRUE(IsSnapshot(path));
+
+            auto gotKMers = kh_init_S64M();
+            for (auto &&kMer : t.alreadyLoaded) insertCanonicalKMer(gotKMers, kMer);
+            LoadSnapshot(gotKMers, path, 3, true, 2);
+            for (auto &&kMer : t.alreadyLoaded) insertCanonicalKMer(kMers, kMer);
+
+            auto want = kMersToVec(kMers);
+            auto got = kMersToVec(gotKMers);
+            sort(want.begin(), want.end());
+            sort(got.begin(), got.end());
+            EXPECT_EQ(want, got);
+            for (auto &&kMer : want) {
+                EXPECT_EQ(kh_val(kMers, kh_get_S64M(kMers, kMer)), kh_val(gotKMers, kh_get_S64M(gotKMers, kMer)));
+            }
+
+            // The view queries the mapped snapshot in place.
+            MappedSnapshot snapshot = MapSnapshot(path, 3, true, sizeof(kmer_t));
+            auto view = SnapshotView<kh_S64M_t>(snapshot);
+            for (auto &&kMer : t.kMers) EXPECT_NE(kh_end(&view), kh_get_S64M(&view, kMer));
+            EXPECT_EQ(kh_end(&view), kh_get_S64M(&view, 0b111111));
+            UnmapSnapshot(snapshot);
+
+            kh_destroy_S64M(kMers);
+            kh_destroy_S64M(gotKMers);
+        }
+        remove(path.c_str());
+        EXPECT_FALSE(IsSnapshot(path));
+        EXPECT_FALSE(IsSnapshot("-"));
+    }
+}
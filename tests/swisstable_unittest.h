@@ -0,0 +1,133 @@
+#pragma once
+#include "../src/khash_utils.h"
+#include "../src/prophasm.h"
+
+#include <unordered_set>
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+namespace {
+    TEST(SwissTable, PutGetDel) {
+        // Few distinct k-mers so that many deletions and reinsertions hit the same slots.
+        for (kmer_t range : {10, 1000, 100000}) {
+            srand(42);
+            KMerSwissTable<kmer_t, false> table;
+            std::unordered_set<kmer_t> want;
+            for (int i = 0; i < 200000; ++i) {
+                kmer_t kMer = rand() % range;
+                int ret;
+                if (rand() % 3) {
+                    khint_t index = table.Put(kMer, &ret);
+                    EXPECT_EQ(want.insert(kMer).second, ret == 1);
+                    EXPECT_EQ(kMer, kh_key(&table, index));
+                } else {
+                    khint_t index = table.Get(kMer);
+                    EXPECT_EQ(want.count(kMer) == 1, index != kh_end(&table));
+                    if (index != kh_end(&table)) {
+                        table.Del(index);
+                        want.erase(kMer);
+                    }
+                }
+            }
+            EXPECT_EQ(want.size(), kh_size(&table));
+            size_t gotCount = 0;
+            for (khint_t i = kh_begin(&table); i != kh_end(&table); ++i) {
+                if (!table.Exists(i)) continue;
+                ++gotCount;
+                EXPECT_EQ(1, want.count(kh_key(&table, i)));
+            }
+            EXPECT_EQ(want.size(), gotCount);
+            auto probes = probeLengthStats(&table);
+            EXPECT_EQ(want.size(), probes.lookups);
+            EXPECT_LE(probes.lookups, probes.total);
+        }
+    }
+
+    TEST(SwissTable, Values) {
+        KMerSwissTable<kmer128_t, true> table;
+        int ret;
+        for (kmer128_t kMer = 0; kMer < 5000; ++kMer) {
+            khint_t index = table.Put(kMer << 64 | kMer, &ret);
+            kh_val(&table, index) = (byte) kMer;
+        }
+        for (kmer128_t kMer = 0; kMer < 5000; ++kMer) {
+            khint_t index = table.Get(kMer << 64 | kMer);
+            ASSERT_NE(kh_end(&table), index);
+            EXPECT_EQ((byte) kMer, kh_val(&table, index));
+        }
+        EXPECT_EQ(kh_end(&table), table.Get(5000));
+    }
+
+    TEST(SwissTable, ResizeAndClear) {
+        KMerSwissTable<kmer_t, false> table;
+        table.Resize(1000);
+        EXPECT_EQ(1024, kh_end(&table));
+        int ret;
+        for (kmer_t kMer = 0; kMer < 800; ++kMer) table.Put(kMer, &ret);
+        EXPECT_EQ(1024, kh_end(&table));
+        for (kmer_t kMer = 0; kMer < 700; ++kMer) table.Del(table.Get(kMer));
+        EXPECT_EQ(100, table.size);
+        EXPECT_GE(700, table.Tombstones());
+        // Shrinking below the number of k-mers is ignored.
+        table.Resize(16);
+        EXPECT_EQ(1024, kh_end(&table));
+        table.Resize(100);
+        EXPECT_EQ(128, kh_end(&table));
+        EXPECT_EQ(0, table.Tombstones());
+        for (kmer_t kMer = 0; kMer < 800; ++kMer) EXPECT_EQ(kMer >= 700, table.Get(kMer) != kh_end(&table));
+
+        table.Clear();
+        EXPECT_EQ(0, kh_size(&table));
+        EXPECT_EQ(kh_end(&table), table.Get(750));
+        table.Put(750, &ret);
+        EXPECT_EQ(1, ret);
+        EXPECT_NE(kh_end(&table), table.Get(750));
+    }
+
+    TEST(SwissTable, GenericOperations) {
+        typedef KMerSwissTable<kmer_t, false> table_t;
+        int k = 5;
+        srand(42);
+        std::vector<table_t *> kMerSets = {KMerTable<table_t>::Init(), KMerTable<table_t>::Init()};
+        for (auto kMers : kMerSets) {
+            for (int i = 0; i < 600; ++i) insertKMer(kMers, rand() & MaskForK64(k), k, true);
+        }
+        std::vector<kmer_t> wantIntersection;
+        for (auto kMer : kMersToVec(kMerSets[0])) {
+            if (containsCanonicalKMer(kMerSets[1], kMer)) wantIntersection.push_back(kMer);
+        }
+        auto intersection = KMerTable<table_t>::Init();
+        getIntersection(intersection, kMerSets, 2);
+        auto gotIntersection = kMersToVec(intersection);
+        std::sort(wantIntersection.begin(), wantIntersection.end());
+        std::sort(gotIntersection.begin(), gotIntersection.end());
+        EXPECT_EQ(wantIntersection, gotIntersection);
+
+        size_t wantSize = kh_size(kMerSets[0]) - kh_size(intersection);
+        differenceInPlace(kMerSets[0], intersection);
+        EXPECT_EQ(wantSize, kh_size(kMerSets[0]));
+        for (auto kMer : gotIntersection) EXPECT_FALSE(containsCanonicalKMer(kMerSets[0], kMer));
+
+        auto wantKMers = kMersToVec(kMerSets[0]);
+        std::stringstream of;
+        ComputeSimplitigs(kMerSets[0], of, k, true, 3);
+        std::vector<kmer_t> gotKMers;
+        std::string line;
+        while (std::getline(of, line)) {
+            if (line[0] == '>') continue;
+            for (size_t i = 0; i + k <= line.size(); ++i) {
+                kmer_t kMer = 0;
+                for (int j = 0; j < k; ++j) kMer = (kMer << 2) | NucleotideToInt(line[i + j]);
+                gotKMers.push_back(CanonicalKMer(kMer, k));
+            }
+        }
+        std::sort(wantKMers.begin(), wantKMers.end());
+        std::sort(gotKMers.begin(), gotKMers.end());
+        EXPECT_EQ(wantKMers, gotKMers);
+        EXPECT_EQ(0, kh_size(kMerSets[0]));
+
+        for (auto kMers : kMerSets) KMerTable<table_t>::Destroy(kMers);
+        KMerTable<table_t>::Destroy(intersection);
+    }
+}
@@ -4,6 +4,14 @@ typedef kmer64_t  kmer_t;
 #include "kmers_unittest.h"
 #include "prophasm_unittest.h"
 #include "khash_utils_unittest.h"
+#include "parser_unittest.h"
+#include "partition_unittest.h"
+#include "snapshot_unittest.h"
+#include "writer_unittest.h"
+#include "hyperloglog_unittest.h"
+#include "swisstable_unittest.h"
+#include "scheduler_unittest.h"
+#include "membership_unittest.h"
 
 #include "gtest/gtest.h"
 
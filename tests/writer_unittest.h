@@ -0,0 +1,41 @@
+#pragma once
+#include "../src/writer.h"
+
+#include <sstream>
+#include <zlib.h>
+
+#include "gtest/gtest.h"
+
+namespace {
+    TEST(Writer, FastaWriter) {
+        struct TestCase {
+            std::string fasta;
+            int lineWidth;
+            std::string fileName;
+            std::string wantResult;
+        };
+        std::vector<TestCase> tests = {
+                {">0\nACGTACGT\n>1\nACG\n", 0, "prophasm_writer_unittest.fa", ">0\nACGTACGT\n>1\nACG\n"},
+                // The headers are not wrapped.
+                {">0 long header\nACGTACGT\n>1\nACG\n", 3, "prophasm_writer_unittest.fa", ">0 long header\nACG\nTAC\nGT\n>1\nACG\n"},
+                {">0\nACGTACGT\n>1\nACG\n", 4, "prophasm_writer_unittest.fa.gz", ">0\nACGT\nACGT\n>1\nACG\n"},
+        };
+
+        for (auto &&t: tests) {
+            std::string path = testing::TempDir() + t.fileName;
+            FastaWriter of(path, t.lineWidth);
+            // Write the input in pieces and with flushes.
+            for (size_t i = 0; i < t.fasta.size(); i += 5) of << t.fasta.substr(i, 5) << std::flush;
+            of.Close();
+
+            // Gzipped files are recognized by gzread too, plain files are read as they are.
+            gzFile file = gzopen(path.c_str(), "rb");
+            std::string got(1000, '\0');
+            got.resize(gzread(file, &got[0], got.size()));
+            gzclose(file);
+            remove(path.c_str());
+
+            EXPECT_EQ(t.wantResult, got);
+        }
+    }
+}